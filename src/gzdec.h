@@ -34,6 +34,29 @@ else
     printf("Cannot decompress file");
 }
 
+3. Optionally, hash (or otherwise consume) the output while it is
+   decoded by passing a sink:
+
+gz_sha256 sha;
+unsigned char digest[32];
+
+gzsha256init(&sha);
+result = gzdecsink(in, insize, out, outsize, gzsha256sink, &sha);
+gzsha256final(&sha, digest);
+
+4. Or check whether a file decompresses to a known blob, without any
+   output buffer (GZ_OK on a match, GZ_MISMATCH otherwise):
+
+result = gzdeccmp(in, insize, blob, blobsize);
+
+5. When the input format is not known up front (gzip, multi-member gzip,
+   BGZF, zlib, raw deflate or plain data):
+
+result = gzdecany(in, insize, out, outsize, &outlen, 0, 0);
+
+6. PNG image data is decoded straight from the IDAT chunks, unfiltering
+   each scanline as soon as it is complete (see gzpng() below).
+
 TODO:
 [ ] Test BTYPE=00 and BTYPE=01
 */
@@ -47,11 +70,627 @@ enum gz_result
     GZ_INVMAGIC,
     GZ_INVCMETHOD,
     GZ_INVFILE,
-    GZ_NOSPACE
+    GZ_NOSPACE,
+    GZ_ABORTED,
+    GZ_MISMATCH,
+    GZ_INVCRC,
+    GZ_UNSUPPORTED,
+    GZ_END
 };
 
+enum gz_format
+{
+    /* raw deflate or not compressed at all */
+    GZ_FMT_UNKNOWN,
+    GZ_FMT_GZIP,
+    /* gzip members carrying a BGZF block size, e.g. from bgzip */
+    GZ_FMT_BGZF,
+    GZ_FMT_ZLIB
+};
+
+/* Index files of other tools, see gzindexread() */
+enum gz_idxformat
+{
+    GZ_IDX_UNKNOWN,
+    /* .gzi from bgzip -i: BGZF block offsets */
+    GZ_IDX_BGZIP,
+    /* .gzi from gztool */
+    GZ_IDX_GZTOOL,
+    /* export_index() of indexed_gzip */
+    GZ_IDX_INDEXED_GZIP
+};
+
+/* Output is handed to a sink in chunks of about GZ_CHUNK bytes while it
+   is still in cache. A non-zero return from the sink aborts decoding. */
+#ifndef GZ_CHUNK
+#define GZ_CHUNK (16*1024)
+#endif
+
+typedef int (*gz_sinkfn)(void *user, void *data, unsigned int size);
+
+/* Longest back-reference distance of deflate: how much output a
+   streaming decode must keep */
+#define GZ_WINDOW 32768
+
+/* Smallest read-ahead buffer of a gz_reader: the most output between
+   two places its decoder can stop at (a stored block, or a chunk) */
+#define GZ_AHEAD_MIN ((GZ_CHUNK + 258 > 65535) ? GZ_CHUNK + 258 : 65535)
+
+/* Called before output already handed to a sink is overwritten; returns
+   once nothing reads it any more, non-zero to abort */
+typedef int (*gz_releasefn)(void *user);
+
+/* Slots for stream windows come in GZ_SLAB_CLASSES sizes, 1K << i,
+   carved out of an arena the caller provides. A free slot holds the
+   pointer to the next one, so the arena must be aligned for a pointer,
+   as memory from malloc() is. */
+#define GZ_SLAB_CLASSES 7
+
+/* Slot of a stream while it decodes: its history and room after it */
+#define GZ_STREAM_SLOT (2*GZ_WINDOW)
+
+typedef struct
+gz_slab
+{
+    unsigned char *arena;
+    unsigned int size;
+    unsigned int top;
+    /* bytes in slots handed out */
+    unsigned int inuse;
+    void *free[GZ_SLAB_CLASSES];
+} gz_slab;
+
+/* A place decoding can start from: the deflate block at bit offset in
+   of the compressed data, whose output starts at offset out, with the
+   winsize bytes of output before it as history. A point without history
+   may also be at the header of a gzip member, such as a BGZF block. */
+typedef struct
+gz_point
+{
+    unsigned int out;
+    unsigned int in;
+    unsigned int winsize;
+} gz_point;
+
+/* A range of decoded data to read with gzdecranges() */
+typedef struct
+gz_req
+{
+    unsigned int offset;
+    unsigned int size;
+    void *out;
+    /* filled by gzrangerun() */
+    int result;
+    unsigned int outlen;
+} gz_req;
+
+/* Points in ascending order; the history of point i is at
+   windows + i*GZ_WINDOW (windows may be 0 if no point has any) */
+typedef struct
+gz_index
+{
+    gz_point *points;
+    unsigned int npoints;
+    unsigned int maxpoints;
+    unsigned char *windows;
+    /* decoded and compressed size, 0 if not known */
+    unsigned int size;
+    unsigned int insize;
+    /* output between points, for indexes built later on */
+    unsigned int spacing;
+    /* set when a decode stopped recording points part way, as the next
+       one did not fit (see gzdecindex()); the points so far are good */
+    int truncated;
+    /* trigram filters of the npoints + 1 chunks between points,
+       bloomsize bytes each (blooms may be 0), see gzindexsearch() */
+    unsigned char *blooms;
+    unsigned int bloomsize;
+} gz_index;
+
+/* Reads of a file through its index, see gzreaderread() */
+typedef struct
+gz_reader
+{
+    gz_index *idx;
+    unsigned char *in;
+    unsigned int insize;
+    int format;
+    /* the decoder's window, holding have bytes of history */
+    unsigned char *window;
+    unsigned int windowsize;
+    unsigned int have;
+    /* read-ahead, output from bufpos on */
+    unsigned char *buf;
+    unsigned int bufsize;
+    unsigned int bufpos;
+    unsigned int buflen;
+    /* where the decoder stopped, as for gz_stream; verify is set when
+       check covers the current member from its start, at mstart */
+    int positioned;
+    int state;
+    int inblock;
+    unsigned int hdrpos;
+    unsigned int pos;
+    unsigned int outpos;
+    unsigned int check;
+    int verify;
+    unsigned int mstart;
+    /* end of the last read and the reads in a row that started at the
+       end of the one before */
+    unsigned int last;
+    unsigned int seq;
+} gz_reader;
+
+/* A decode fed its input piece by piece. win holds the last have
+   bytes of output of the current member, in a slot of winsize bytes
+   that is decoded into directly. */
+typedef struct
+gz_stream
+{
+    int format;
+    int state;
+    int inblock;
+    unsigned int hdrpos;
+    unsigned int pos;
+    unsigned int check;
+    unsigned int size;
+    unsigned char *win;
+    unsigned int winsize;
+    unsigned int have;
+    /* optional index to record points in, see gzdecindex(); inpos is
+       the offset of the next call's input in the compressed data,
+       outpos the output so far */
+    gz_index *idx;
+    unsigned int inpos;
+    unsigned int outpos;
+} gz_stream;
+
+/* Writes size bytes at offsethi * 2^32 + offset of the output file
+   (zeros if data is 0, see gzdecsparse()); non-zero aborts */
+typedef int (*gz_writefn)(
+    void *user, void *data, unsigned int size,
+    unsigned int offset, unsigned int offsethi);
+
+/* Called with the output offset of every match gzindexsearch() finds,
+   in ascending order; non-zero stops the search */
+typedef int (*gz_matchfn)(void *user, unsigned int offset);
+
+/* Runs task(arg, 0) ... task(arg, count - 1), possibly at the same
+   time on different threads, and returns once all of them are done */
+typedef void (*gz_taskfn)(void *arg, unsigned int index);
+typedef void (*gz_runfn)(
+    void *user, gz_taskfn task, void *arg, unsigned int count);
+
+/* Current time in ticks of the caller's choice, e.g. milliseconds */
+typedef unsigned int (*gz_clockfn)(void *user);
+
+#define GZ_PAR_MAX 64
+
+/* Smallest part gzcrc32par() gives a thread */
+#ifndef GZ_CRC_PARMIN
+#define GZ_CRC_PARMIN (1 << 20)
+#endif
+
+typedef struct
+gz_par
+{
+    gz_runfn run;
+    void *user;
+    /* speculative parts per block, at most GZ_PAR_MAX */
+    unsigned int nparts;
+    /* speculate when at least this many bits of input are left */
+    unsigned int minbits;
+    /* room for the speculative parts, two words per token */
+    unsigned int *work;
+    unsigned int worksize;
+} gz_par;
+
+/* LZ77 tokens, one unsigned int each: a literal byte (0-255), a match
+   (GZ_TOK_MATCH | length << 16 | distance) or the start of a deflate
+   block (GZ_TOK_BLOCK | btype << 1 | islast) */
+#define GZ_TOK_MATCH 0x80000000U
+#define GZ_TOK_BLOCK 0x40000000U
+
+typedef int (*gz_tokfn)(void *user, unsigned int *tok, unsigned int count);
+
+typedef struct
+gz_res
+{
+    unsigned char *out;
+    unsigned int outsize;
+    unsigned int outlen;
+    /* CRC-32 and start in out of the current member */
+    unsigned int crc;
+    unsigned int mstart;
+} gz_res;
+
+typedef struct
+gz_tokenc
+{
+    gz_sinkfn sink;
+    void *user;
+    unsigned int nlit;
+    unsigned int n;
+    unsigned char lit[128];
+    unsigned char buf[1024];
+} gz_tokenc;
+
+typedef struct
+gz_sha256
+{
+    unsigned int h[8];
+    unsigned int lenlo;
+    unsigned int lenhi;
+    unsigned char buf[64];
+    unsigned int buflen;
+} gz_sha256;
+
+typedef struct
+gz_xxh32
+{
+    unsigned int v[4];
+    unsigned int seed;
+    unsigned int len;
+    int large;
+    unsigned char buf[16];
+    unsigned int buflen;
+} gz_xxh32;
+
 unsigned int gzdecsize(void *in, unsigned int insize);
 int gzdec(void *in, unsigned int insize, void *out, unsigned int outsize);
+int gzdecsink(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize,
+    gz_sinkfn sink, void *user);
+int gzdeccmp(void *in, unsigned int insize, void *ref, unsigned int refsize);
+int gzdecpar(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize,
+    gz_runfn run, void *user);
+int gzdecbufindex(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, gz_index *idx);
+
+int gzdectok(
+    void *in, unsigned int insize, unsigned int *used,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user);
+int gzdectokpar(
+    void *in, unsigned int insize, unsigned int *used,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user, gz_par *par);
+void gzresinit(gz_res *res, void *out, unsigned int outsize);
+int gzresolve(gz_res *res, unsigned int *tok, unsigned int count);
+int gzresend(gz_res *res, void *in, unsigned int used);
+int gzdecpipe(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, unsigned int *outlen,
+    unsigned int *buf, unsigned int bufmax,
+    gz_runfn run, void *user);
+
+void gztokencinit(gz_tokenc *enc, gz_sinkfn sink, void *user);
+int gztokenc(void *user, unsigned int *tok, unsigned int count);
+int gztokencend(gz_tokenc *enc);
+int gztokdec(
+    void *data, unsigned int size,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user);
+
+unsigned int gzcrc32(unsigned int crc, void *data, unsigned int size);
+unsigned int gzcrc32combine(
+    unsigned int crc1, unsigned int crc2, unsigned int size2);
+unsigned int gzcrc32par(
+    unsigned int crc, void *data, unsigned int size,
+    gz_runfn run, void *user);
+unsigned int gzadler32(unsigned int adler, void *data, unsigned int size);
+
+typedef struct
+gz_png
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int depth;
+    unsigned int color;
+    unsigned int channels;
+    /* bytes per scanline in the unfiltered image */
+    unsigned int stride;
+    /* bytes per complete pixel, at least 1 */
+    unsigned int bpp;
+    /* sizes of the buffers gzpng() needs: the deflate window and the
+       unfiltered image */
+    unsigned int scratchsize;
+    unsigned int imgsize;
+} gz_png;
+
+typedef struct
+gz_job
+{
+    void *in;
+    unsigned int insize;
+    void *out;
+    unsigned int outsize;
+    /* decoded size recorded by the container, 0 if it has none; filled
+       by gzbatchplan() */
+    unsigned int size;
+    /* filled by gzbatchrun() */
+    int result;
+    unsigned int outlen;
+    /* filled by gzbatchtimed(): ticks spent on the job and decoded
+       bytes per tick */
+    unsigned int ticks;
+    unsigned int rate;
+} gz_job;
+
+typedef struct
+gz_report
+{
+    unsigned int files;
+    unsigned int failed;
+    /* total compressed and decoded bytes, low and high words */
+    unsigned int insize;
+    unsigned int insizehi;
+    unsigned int outsize;
+    unsigned int outsizehi;
+    /* sum of the jobs' ticks, i.e. the time of all workers together */
+    unsigned int ticks;
+    /* decoded bytes per tick over the batch's elapsed time, and per
+       tick of a single worker */
+    unsigned int rate;
+    unsigned int workerrate;
+} gz_report;
+
+typedef struct
+gz_tune
+{
+    /* workers to run the next batch with */
+    unsigned int workers;
+    unsigned int maxworkers;
+    /* percent more throughput a worker count must bring to be taken */
+    unsigned int gain;
+    /* fewest workers with the best throughput so far */
+    unsigned int best;
+    unsigned int bestrate;
+    /* most workers known to fall short of best, fewest known not to
+       improve on it (0 while ramping up) */
+    unsigned int lo;
+    unsigned int hi;
+    /* narrowing down from below best instead of from above */
+    int down;
+    int done;
+} gz_tune;
+
+typedef int (*gz_fieldfn)(
+    void *user, unsigned int row, unsigned int col,
+    char *field, unsigned int size);
+
+typedef struct
+gz_csv
+{
+    int delim;
+    /* -1 when fields are never quoted, e.g. for TSV */
+    int quote;
+    /* emit column col if col < nselect && select[col] */
+    unsigned char *select;
+    unsigned int nselect;
+    gz_fieldfn field;
+    void *user;
+
+    unsigned char *fstart;
+    unsigned char *last;
+    unsigned int row;
+    unsigned int col;
+    int inquote;
+} gz_csv;
+
+typedef int (*gz_jsonfn)(
+    void *user, unsigned int line, char *rec, unsigned int size,
+    unsigned int *index, unsigned int nindex);
+
+typedef struct
+gz_ndjson
+{
+    gz_jsonfn record;
+    void *user;
+    unsigned int *index;
+    unsigned int indexmax;
+    /* why the sink stopped, if it did */
+    int error;
+
+    unsigned char *rstart;
+    unsigned char *last;
+    unsigned int line;
+} gz_ndjson;
+
+/* Largest uncompressed size of a BGZF block */
+#define GZ_BGZF_MAX 65536
+
+typedef struct
+gz_bamrec
+{
+    /* the record after its block_size field: refID at data + 0, pos at
+       data + 4, and so on */
+    unsigned char *data;
+    unsigned int size;
+    /* virtual offset of the record: BGZF block offset, offset within */
+    unsigned int coff;
+    unsigned int uoff;
+} gz_bamrec;
+
+typedef struct
+gz_bam
+{
+    unsigned char *in;
+    unsigned int insize;
+    /* offsets of the decoded block and of the one after it */
+    unsigned int coff;
+    unsigned int nextcoff;
+    unsigned int blen;
+    unsigned int upos;
+    unsigned int nref;
+    unsigned char *stitch;
+    unsigned int stitchsize;
+    unsigned char block[GZ_BGZF_MAX];
+} gz_bam;
+
+int gzformat(void *in, unsigned int insize);
+int gzdecany(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user);
+int gzdecstream(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user);
+int gzdecindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user, gz_index *idx);
+int gzdecpages(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int page,
+    unsigned int *outlen,
+    gz_sinkfn sink, gz_releasefn release, void *user);
+int gzdecdirect(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user);
+int gzdecsparse(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user);
+int gzdecdirectindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user, gz_index *idx);
+int gzdecsparseindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user, gz_index *idx);
+
+void gzslabinit(gz_slab *slab, void *arena, unsigned int size);
+void *gzslaballoc(gz_slab *slab, unsigned int size);
+void gzslabfree(gz_slab *slab, void *p, unsigned int size);
+void gzstreaminit(gz_stream *st, int format);
+int gzstreamdec(
+    gz_stream *st, gz_slab *slab,
+    void *in, unsigned int insize, unsigned int *used,
+    gz_sinkfn sink, void *user);
+void gzstreamidle(gz_stream *st, gz_slab *slab);
+void gzstreamend(gz_stream *st, gz_slab *slab);
+
+void gzindexinit(
+    gz_index *idx, gz_point *points, unsigned int maxpoints,
+    void *windows);
+unsigned int gzindexcount(void *data, unsigned int size);
+int gzindexread(gz_index *idx, void *data, unsigned int size);
+int gzindexwrite(gz_index *idx, int format, gz_sinkfn sink, void *user);
+int gzdecrange(
+    gz_index *idx, void *in, unsigned int insize,
+    unsigned int offset, void *out, unsigned int size,
+    unsigned int *outlen, void *window, unsigned int windowsize);
+unsigned int gzrangeplan(
+    gz_index *idx, gz_req *reqs, unsigned int nreqs,
+    unsigned int *order, unsigned int *spans);
+int gzrangerun(
+    gz_index *idx, void *in, unsigned int insize,
+    gz_req *reqs, unsigned int *order,
+    unsigned int first, unsigned int last,
+    void *window, unsigned int windowsize);
+int gzdecranges(
+    gz_index *idx, void *in, unsigned int insize,
+    gz_req *reqs, unsigned int nreqs,
+    unsigned int *order, unsigned int *spans,
+    void *window, unsigned int windowsize,
+    gz_runfn run, void *user);
+void gzreaderinit(
+    gz_reader *r, gz_index *idx, void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    void *buf, unsigned int bufsize);
+int gzreaderread(
+    gz_reader *r, unsigned int offset, void *out, unsigned int size,
+    unsigned int *outlen);
+int gzreaderahead(gz_reader *r);
+void gzindexbloom(gz_index *idx, void *blooms, unsigned int bloomsize);
+int gzindexsearch(
+    gz_index *idx, void *in, unsigned int insize,
+    void *needle, unsigned int len,
+    void *window, unsigned int windowsize,
+    gz_matchfn match, void *user);
+
+unsigned int gzbatchplan(
+    gz_job *jobs, unsigned int njobs,
+    unsigned int *order, unsigned int *groups, unsigned int groupsize);
+int gzbatchrun(
+    gz_job *jobs, unsigned int *order,
+    unsigned int first, unsigned int last);
+int gzbatchtimed(
+    gz_job *jobs, unsigned int *order,
+    unsigned int first, unsigned int last,
+    gz_clockfn clock, void *user);
+void gzbatchreport(
+    gz_job *jobs, unsigned int njobs, unsigned int ticks,
+    gz_report *report);
+unsigned int gzbgzfsplit(
+    void *in, unsigned int insize, void *out, unsigned int outsize,
+    gz_job *parts, unsigned int maxparts, unsigned int partsize);
+
+unsigned int gzdecmem(void);
+unsigned int gzindexmem(unsigned int npoints);
+unsigned int gzbatchmem(
+    gz_job *jobs, unsigned int *order, unsigned int *groups, unsigned int g);
+unsigned int gzbatchworkers(
+    gz_job *jobs, unsigned int *order,
+    unsigned int *groups, unsigned int ngroups,
+    unsigned int budget, unsigned int maxworkers);
+void gztuneinit(gz_tune *tune, unsigned int maxworkers);
+unsigned int gztune(gz_tune *tune, unsigned int rate);
+
+void gzcsvinit(
+    gz_csv *csv, int delim, int quote,
+    unsigned char *select, unsigned int nselect,
+    gz_fieldfn field, void *user);
+int gzcsvsink(void *user, void *data, unsigned int size);
+int gzcsvend(gz_csv *csv);
+
+void gzndjsoninit(
+    gz_ndjson *nd, unsigned int *index, unsigned int indexmax,
+    gz_jsonfn record, void *user);
+int gzndjsonsink(void *user, void *data, unsigned int size);
+int gzndjsonend(gz_ndjson *nd);
+
+int gzbamopen(
+    gz_bam *bam, void *in, unsigned int insize,
+    void *stitch, unsigned int stitchsize);
+int gzbamnext(gz_bam *bam, gz_bamrec *rec);
+int gzbamseek(gz_bam *bam, unsigned int coff, unsigned int uoff);
+int gzbaiseek(
+    gz_bam *bam, void *bai, unsigned int baisize,
+    unsigned int refid, unsigned int beg);
+unsigned int gzbammem(gz_bam *bam);
+
+int gzpnginfo(void *in, unsigned int insize, gz_png *png);
+int gzpng(
+    void *in, unsigned int insize,
+    void *scratch, unsigned int scratchsize,
+    void *img, unsigned int imgsize);
+
+void gzsha256init(gz_sha256 *sha);
+void gzsha256update(gz_sha256 *sha, void *data, unsigned int size);
+void gzsha256final(gz_sha256 *sha, unsigned char digest[32]);
+int gzsha256sink(void *user, void *data, unsigned int size);
+
+void gzxxh32init(gz_xxh32 *xxh, unsigned int seed);
+void gzxxh32update(gz_xxh32 *xxh, void *data, unsigned int size);
+unsigned int gzxxh32final(gz_xxh32 *xxh);
+int gzxxh32sink(void *user, void *data, unsigned int size);
 
 #ifdef GZDEC_IMPLEMENTATION
 #ifndef GZDEC_IMPLEMENTED
@@ -67,6 +706,12 @@ gz_bstream
     /* current bit position within buf, 8 is MSB */
     unsigned char mask;
     int end;
+    /* set once a read goes past the end of src */
+    int overrun;
+    /* optional: called at the end of src to move on to the next piece
+       of input, returns 0 when there is none */
+    int (*refill)(struct gz_bstream *stream);
+    void *user;
 } gz_bstream;
 
 typedef struct
@@ -77,6 +722,19 @@ gz_huffn
     struct gz_huffn *one;
 } gz_huffn;
 
+static void
+gz_nextbyte(gz_bstream *stream)
+{
+    if(stream->ptr >= stream->srcend &&
+       !(stream->refill && stream->refill(stream)))
+    {
+        stream->end = 1;
+        return;
+    }
+
+    stream->buf = *stream->ptr++;
+}
+
 static unsigned int
 gz_nextbit(gz_bstream *stream)
 {
@@ -84,6 +742,7 @@ gz_nextbit(gz_bstream *stream)
 
     if(stream->end)
     {
+        stream->overrun = 1;
         return(0);
     }
 
@@ -92,25 +751,58 @@ gz_nextbit(gz_bstream *stream)
     if(!stream->mask)
     {
         stream->mask = 1;
-
-        if(stream->ptr < stream->srcend)
-        {
-            stream->buf = *stream->ptr++;
-        }
-        else
-        {
-            stream->end = 1;
-        }
+        gz_nextbyte(stream);
     }
 
     return(bit);
 }
 
+/* Index of the bit mask selects within buf */
+static unsigned int
+gz_maskbit(unsigned char mask)
+{
+    return(((mask & 0xf0) ? 4 : 0) | ((mask & 0xcc) ? 2 : 0) |
+           ((mask & 0xaa) ? 1 : 0));
+}
+
+/* The next 17 or more bits, for when the two bytes after buf are at
+   hand: in the low bits, first bit lowest; bit is
+   gz_maskbit(stream->mask) */
+static unsigned int
+gz_peekbits(gz_bstream *stream, unsigned int bit)
+{
+    return(((unsigned int)stream->buf |
+            ((unsigned int)stream->ptr[0] << 8) |
+            ((unsigned int)stream->ptr[1] << 16)) >> bit);
+}
+
+/* Move to bit pos (at most 23) counted from the start of buf */
+static void
+gz_dropbits(gz_bstream *stream, unsigned int pos)
+{
+    if(pos >= 8)
+    {
+        stream->ptr += pos / 8;
+        stream->buf = stream->ptr[-1];
+    }
+    stream->mask = (unsigned char)(1 << (pos % 8));
+}
+
 static unsigned int
 gz_readbits(gz_bstream *stream, int count)
 {
     int bitsval, i, bit;
 
+    /* Away from the end of src, take the bits at once */
+    if(!stream->end && count <= 16 && stream->srcend - stream->ptr >= 2)
+    {
+        i = (int)gz_maskbit(stream->mask);
+        bitsval = (int)(gz_peekbits(stream, (unsigned int)i) &
+                        ((1U << count) - 1));
+        gz_dropbits(stream, (unsigned int)(i + count));
+        return(bitsval);
+    }
+
     bitsval = 0;
     for(i = 0;
         i < count;
@@ -123,6 +815,19 @@ gz_readbits(gz_bstream *stream, int count)
     return(bitsval);
 }
 
+/* Skip the remaining bits of the current byte */
+static void
+gz_alignbyte(gz_bstream *stream)
+{
+    if(stream->end || stream->mask == 1)
+    {
+        return;
+    }
+
+    stream->mask = 1;
+    gz_nextbyte(stream);
+}
+
 void
 gz_memset(void *dst, int val, unsigned int count)
 {
@@ -224,15 +929,22 @@ gz_torange(
 #define GZ_NXTCODE_MAX GZ_BL_COUNT_MAX
 #define GZ_TREE_MAX GZ_LL_MAX
 
-gz_range gz_range_[GZ_RANGE_MAX];
-int gz_blcount_[GZ_BL_COUNT_MAX];
-int gz_nxtcode_[GZ_NXTCODE_MAX];
-gz_tnode gz_tree_[GZ_TREE_MAX];
+/* Working memory of gz_buildht, kept per decode so that decoding is
+   reentrant */
+typedef struct
+gz_htscratch
+{
+    gz_range range[GZ_RANGE_MAX];
+    int blcount[GZ_BL_COUNT_MAX];
+    int nxtcode[GZ_NXTCODE_MAX];
+    gz_tnode tree[GZ_TREE_MAX];
+} gz_htscratch;
 
 int
 gz_buildht(
     unsigned int *cl, unsigned int count,
-    gz_huffn *ht, unsigned int htmax)
+    gz_huffn *ht, unsigned int htmax,
+    gz_htscratch *scratch)
 {
     int *blcount, *nxtcode;
     gz_tnode *tree;
@@ -249,7 +961,7 @@ gz_buildht(
         return(0);
     }
 
-    range = gz_range_;
+    range = scratch->range;
     rcount = gz_torange(cl, count, range, count);
     if(rcount < 0)
     {
@@ -271,19 +983,19 @@ gz_buildht(
     {
         return(0);
     }
-    blcount = gz_blcount_;
+    blcount = scratch->blcount;
 
     if(maxblen + 1 > GZ_NXTCODE_MAX)
     {
         return(0);
     }
-    nxtcode = gz_nxtcode_;
+    nxtcode = scratch->nxtcode;
 
     if(range[rcount - 1].end + 1 > GZ_TREE_MAX)
     {
         return(0);
     }
-    tree = gz_tree_;
+    tree = scratch->tree;
 
     if(!blcount || !nxtcode || !tree)
     {
@@ -395,26 +1107,18 @@ gz_buildht(
     return(1);
 }
 
+/* Read count code lengths. The literal/length and distance lengths form
+   one sequence, as repeat codes may run from one into the other. */
 int
-gz_gethufft(
+gz_getlens(
     gz_bstream *stream,
     unsigned int *lengths,
     unsigned int count,
-    unsigned int maxcount,
-    gz_huffn *htclen,
-    gz_huffn *ht,
-    unsigned int htmax)
+    gz_huffn *htclen)
 {
     unsigned int i, val, rep;
     int sym;
 
-    for(i = 0;
-        i < maxcount;
-        ++i)
-    {
-        lengths[i] = 0;
-    }
-
     i = 0;
     while(i < count)
     {
@@ -454,6 +1158,11 @@ gz_gethufft(
             return(0);
         }
 
+        if(rep > count - i)
+        {
+            return(0);
+        }
+
         while(rep > 0)
         {
             lengths[i++] = val;
@@ -461,12 +1170,7 @@ gz_gethufft(
         }
     }
 
-    if(i != count)
-    {
-        return(0);
-    }
-
-    return(gz_buildht(lengths, maxcount, ht, htmax));
+    return(1);
 }
 
 /**
@@ -562,346 +1266,7736 @@ gz_getdist(int code, gz_bstream *stream)
 #define GZ_HTDIST_MAX ((GZ_DIST_MAX)*2 - 1)
 #define GZ_HTCLEN_MAX ((GZ_CLEN_MAX)*2 - 1)
 
-gz_huffn gz_htll_[GZ_HTLL_MAX];
-gz_huffn gz_htdist_[GZ_HTDIST_MAX];
-gz_huffn gz_htclen_[GZ_HTCLEN_MAX];
 
-int
-gzdec(
-    void *in, unsigned int insize,
-    void *out, unsigned int outsize)
+static unsigned int
+gz_read32le(unsigned char *p)
 {
-#define FTEXT 0x01
-#define FHCRC 0x02
-#define FEXTRA 0x04
-#define FNAME 0x08
-#define FCOMMENT 0x10
-#define MAXCLEN GZ_CLEN_MAX
-#define LLLEN GZ_LL_MAX
-#define DISTLEN GZ_DIST_MAX
-
-#define EMIT(b)\
-    if(outp >= outend)\
-    {\
-        return(GZ_INVFILE);\
-    }\
-    *outp++ = (unsigned char)((b) & 0xff);
-
-    gz_bstream ins = {0};
-    unsigned char magic[2];
-    unsigned int cm, flags, xlen;
-    unsigned int islast, btype;
-    unsigned int hlit, hdist, hclen;
-    unsigned int i;
-    int sym, dist, len;
-    int todec;
-
-    unsigned int b0len, b0nlen;
+    return((unsigned int)p[0] |
+           ((unsigned int)p[1] << 8) |
+           ((unsigned int)p[2] << 16) |
+           ((unsigned int)p[3] << 24));
+}
 
-    unsigned int arrclen[MAXCLEN] = {0};
-    unsigned int clenord[MAXCLEN] = {
-        16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15
-    };
-    gz_huffn *htclen;
+static unsigned int
+gz_read32be(unsigned char *p)
+{
+    return(((unsigned int)p[0] << 24) |
+           ((unsigned int)p[1] << 16) |
+           ((unsigned int)p[2] << 8) |
+           (unsigned int)p[3]);
+}
 
-    unsigned int arrll[LLLEN] = {0};
-    unsigned int arrdist[DISTLEN] = {0};
-    gz_huffn *htll, *htdist;
+/* Word-at-a-time byte search over four bytes read into v: non-zero if
+   any of them is 0 (GZ_HASZERO) or c (GZ_HASBYTE) */
+#define GZ_HASZERO(v) (((v) - 0x01010101U) & ~(v) & 0x80808080U)
+#define GZ_HASBYTE(v, c) GZ_HASZERO((v) ^ (0x01010101U * (unsigned char)(c)))
 
-    unsigned char *outp, *outend, *backp;
+/**
+  CRC-32 as used by the gzip trailer (reflected, polynomial 0xedb88320),
+  table driven, four bytes per step.
+
+  gzcrc32combine() gives the CRC of A followed by B from the CRCs of A
+  and B and the size of B, so large buffers can be checksummed in slices
+  on several threads and merged:
+
+  crca = gzcrc32(0, buf, half);
+  crcb = gzcrc32(0, buf + half, size - half);
+  crc = gzcrc32combine(crca, crcb, size - half);
+
+  gzcrc32par() does just that through a gz_runfn: buffers of at least
+  2 * GZ_CRC_PARMIN bytes are cut into parts of at least GZ_CRC_PARMIN
+  (no more than GZ_PAR_MAX), which run checksums side by side, and the
+  results are merged in order. Smaller buffers are checksummed in place.
+  gzdecpar() verifies the trailer of large members this way. The tables
+  are constant, so any thread may checksum at any time.
+*/
 
-    outp = (unsigned char *)out;
-    outend = outp + outsize;
+#define GZ_CRC_POLY 0xedb88320U
 
-    if(!in || insize < 18)
+/* Slice-by-4 tables: [0] is the bytewise table, [k] advances [k - 1]
+   by one more zero byte */
+static const unsigned int gz_crctable_[4][256] =
+{
     {
-        return(GZ_INVFILE);
-    }
-
-    i = gzdecsize(in, insize);
-    if(i == 0)
+        0x00000000U, 0x77073096U, 0xee0e612cU, 0x990951baU, 0x076dc419U,
+        0x706af48fU, 0xe963a535U, 0x9e6495a3U, 0x0edb8832U, 0x79dcb8a4U,
+        0xe0d5e91eU, 0x97d2d988U, 0x09b64c2bU, 0x7eb17cbdU, 0xe7b82d07U,
+        0x90bf1d91U, 0x1db71064U, 0x6ab020f2U, 0xf3b97148U, 0x84be41deU,
+        0x1adad47dU, 0x6ddde4ebU, 0xf4d4b551U, 0x83d385c7U, 0x136c9856U,
+        0x646ba8c0U, 0xfd62f97aU, 0x8a65c9ecU, 0x14015c4fU, 0x63066cd9U,
+        0xfa0f3d63U, 0x8d080df5U, 0x3b6e20c8U, 0x4c69105eU, 0xd56041e4U,
+        0xa2677172U, 0x3c03e4d1U, 0x4b04d447U, 0xd20d85fdU, 0xa50ab56bU,
+        0x35b5a8faU, 0x42b2986cU, 0xdbbbc9d6U, 0xacbcf940U, 0x32d86ce3U,
+        0x45df5c75U, 0xdcd60dcfU, 0xabd13d59U, 0x26d930acU, 0x51de003aU,
+        0xc8d75180U, 0xbfd06116U, 0x21b4f4b5U, 0x56b3c423U, 0xcfba9599U,
+        0xb8bda50fU, 0x2802b89eU, 0x5f058808U, 0xc60cd9b2U, 0xb10be924U,
+        0x2f6f7c87U, 0x58684c11U, 0xc1611dabU, 0xb6662d3dU, 0x76dc4190U,
+        0x01db7106U, 0x98d220bcU, 0xefd5102aU, 0x71b18589U, 0x06b6b51fU,
+        0x9fbfe4a5U, 0xe8b8d433U, 0x7807c9a2U, 0x0f00f934U, 0x9609a88eU,
+        0xe10e9818U, 0x7f6a0dbbU, 0x086d3d2dU, 0x91646c97U, 0xe6635c01U,
+        0x6b6b51f4U, 0x1c6c6162U, 0x856530d8U, 0xf262004eU, 0x6c0695edU,
+        0x1b01a57bU, 0x8208f4c1U, 0xf50fc457U, 0x65b0d9c6U, 0x12b7e950U,
+        0x8bbeb8eaU, 0xfcb9887cU, 0x62dd1ddfU, 0x15da2d49U, 0x8cd37cf3U,
+        0xfbd44c65U, 0x4db26158U, 0x3ab551ceU, 0xa3bc0074U, 0xd4bb30e2U,
+        0x4adfa541U, 0x3dd895d7U, 0xa4d1c46dU, 0xd3d6f4fbU, 0x4369e96aU,
+        0x346ed9fcU, 0xad678846U, 0xda60b8d0U, 0x44042d73U, 0x33031de5U,
+        0xaa0a4c5fU, 0xdd0d7cc9U, 0x5005713cU, 0x270241aaU, 0xbe0b1010U,
+        0xc90c2086U, 0x5768b525U, 0x206f85b3U, 0xb966d409U, 0xce61e49fU,
+        0x5edef90eU, 0x29d9c998U, 0xb0d09822U, 0xc7d7a8b4U, 0x59b33d17U,
+        0x2eb40d81U, 0xb7bd5c3bU, 0xc0ba6cadU, 0xedb88320U, 0x9abfb3b6U,
+        0x03b6e20cU, 0x74b1d29aU, 0xead54739U, 0x9dd277afU, 0x04db2615U,
+        0x73dc1683U, 0xe3630b12U, 0x94643b84U, 0x0d6d6a3eU, 0x7a6a5aa8U,
+        0xe40ecf0bU, 0x9309ff9dU, 0x0a00ae27U, 0x7d079eb1U, 0xf00f9344U,
+        0x8708a3d2U, 0x1e01f268U, 0x6906c2feU, 0xf762575dU, 0x806567cbU,
+        0x196c3671U, 0x6e6b06e7U, 0xfed41b76U, 0x89d32be0U, 0x10da7a5aU,
+        0x67dd4accU, 0xf9b9df6fU, 0x8ebeeff9U, 0x17b7be43U, 0x60b08ed5U,
+        0xd6d6a3e8U, 0xa1d1937eU, 0x38d8c2c4U, 0x4fdff252U, 0xd1bb67f1U,
+        0xa6bc5767U, 0x3fb506ddU, 0x48b2364bU, 0xd80d2bdaU, 0xaf0a1b4cU,
+        0x36034af6U, 0x41047a60U, 0xdf60efc3U, 0xa867df55U, 0x316e8eefU,
+        0x4669be79U, 0xcb61b38cU, 0xbc66831aU, 0x256fd2a0U, 0x5268e236U,
+        0xcc0c7795U, 0xbb0b4703U, 0x220216b9U, 0x5505262fU, 0xc5ba3bbeU,
+        0xb2bd0b28U, 0x2bb45a92U, 0x5cb36a04U, 0xc2d7ffa7U, 0xb5d0cf31U,
+        0x2cd99e8bU, 0x5bdeae1dU, 0x9b64c2b0U, 0xec63f226U, 0x756aa39cU,
+        0x026d930aU, 0x9c0906a9U, 0xeb0e363fU, 0x72076785U, 0x05005713U,
+        0x95bf4a82U, 0xe2b87a14U, 0x7bb12baeU, 0x0cb61b38U, 0x92d28e9bU,
+        0xe5d5be0dU, 0x7cdcefb7U, 0x0bdbdf21U, 0x86d3d2d4U, 0xf1d4e242U,
+        0x68ddb3f8U, 0x1fda836eU, 0x81be16cdU, 0xf6b9265bU, 0x6fb077e1U,
+        0x18b74777U, 0x88085ae6U, 0xff0f6a70U, 0x66063bcaU, 0x11010b5cU,
+        0x8f659effU, 0xf862ae69U, 0x616bffd3U, 0x166ccf45U, 0xa00ae278U,
+        0xd70dd2eeU, 0x4e048354U, 0x3903b3c2U, 0xa7672661U, 0xd06016f7U,
+        0x4969474dU, 0x3e6e77dbU, 0xaed16a4aU, 0xd9d65adcU, 0x40df0b66U,
+        0x37d83bf0U, 0xa9bcae53U, 0xdebb9ec5U, 0x47b2cf7fU, 0x30b5ffe9U,
+        0xbdbdf21cU, 0xcabac28aU, 0x53b39330U, 0x24b4a3a6U, 0xbad03605U,
+        0xcdd70693U, 0x54de5729U, 0x23d967bfU, 0xb3667a2eU, 0xc4614ab8U,
+        0x5d681b02U, 0x2a6f2b94U, 0xb40bbe37U, 0xc30c8ea1U, 0x5a05df1bU,
+        0x2d02ef8dU
+    },
     {
-        return(GZ_INVFILE);
-    }
-
-    if(outsize < i)
+        0x00000000U, 0x191b3141U, 0x32366282U, 0x2b2d53c3U, 0x646cc504U,
+        0x7d77f445U, 0x565aa786U, 0x4f4196c7U, 0xc8d98a08U, 0xd1c2bb49U,
+        0xfaefe88aU, 0xe3f4d9cbU, 0xacb54f0cU, 0xb5ae7e4dU, 0x9e832d8eU,
+        0x87981ccfU, 0x4ac21251U, 0x53d92310U, 0x78f470d3U, 0x61ef4192U,
+        0x2eaed755U, 0x37b5e614U, 0x1c98b5d7U, 0x05838496U, 0x821b9859U,
+        0x9b00a918U, 0xb02dfadbU, 0xa936cb9aU, 0xe6775d5dU, 0xff6c6c1cU,
+        0xd4413fdfU, 0xcd5a0e9eU, 0x958424a2U, 0x8c9f15e3U, 0xa7b24620U,
+        0xbea97761U, 0xf1e8e1a6U, 0xe8f3d0e7U, 0xc3de8324U, 0xdac5b265U,
+        0x5d5daeaaU, 0x44469febU, 0x6f6bcc28U, 0x7670fd69U, 0x39316baeU,
+        0x202a5aefU, 0x0b07092cU, 0x121c386dU, 0xdf4636f3U, 0xc65d07b2U,
+        0xed705471U, 0xf46b6530U, 0xbb2af3f7U, 0xa231c2b6U, 0x891c9175U,
+        0x9007a034U, 0x179fbcfbU, 0x0e848dbaU, 0x25a9de79U, 0x3cb2ef38U,
+        0x73f379ffU, 0x6ae848beU, 0x41c51b7dU, 0x58de2a3cU, 0xf0794f05U,
+        0xe9627e44U, 0xc24f2d87U, 0xdb541cc6U, 0x94158a01U, 0x8d0ebb40U,
+        0xa623e883U, 0xbf38d9c2U, 0x38a0c50dU, 0x21bbf44cU, 0x0a96a78fU,
+        0x138d96ceU, 0x5ccc0009U, 0x45d73148U, 0x6efa628bU, 0x77e153caU,
+        0xbabb5d54U, 0xa3a06c15U, 0x888d3fd6U, 0x91960e97U, 0xded79850U,
+        0xc7cca911U, 0xece1fad2U, 0xf5facb93U, 0x7262d75cU, 0x6b79e61dU,
+        0x4054b5deU, 0x594f849fU, 0x160e1258U, 0x0f152319U, 0x243870daU,
+        0x3d23419bU, 0x65fd6ba7U, 0x7ce65ae6U, 0x57cb0925U, 0x4ed03864U,
+        0x0191aea3U, 0x188a9fe2U, 0x33a7cc21U, 0x2abcfd60U, 0xad24e1afU,
+        0xb43fd0eeU, 0x9f12832dU, 0x8609b26cU, 0xc94824abU, 0xd05315eaU,
+        0xfb7e4629U, 0xe2657768U, 0x2f3f79f6U, 0x362448b7U, 0x1d091b74U,
+        0x04122a35U, 0x4b53bcf2U, 0x52488db3U, 0x7965de70U, 0x607eef31U,
+        0xe7e6f3feU, 0xfefdc2bfU, 0xd5d0917cU, 0xcccba03dU, 0x838a36faU,
+        0x9a9107bbU, 0xb1bc5478U, 0xa8a76539U, 0x3b83984bU, 0x2298a90aU,
+        0x09b5fac9U, 0x10aecb88U, 0x5fef5d4fU, 0x46f46c0eU, 0x6dd93fcdU,
+        0x74c20e8cU, 0xf35a1243U, 0xea412302U, 0xc16c70c1U, 0xd8774180U,
+        0x9736d747U, 0x8e2de606U, 0xa500b5c5U, 0xbc1b8484U, 0x71418a1aU,
+        0x685abb5bU, 0x4377e898U, 0x5a6cd9d9U, 0x152d4f1eU, 0x0c367e5fU,
+        0x271b2d9cU, 0x3e001cddU, 0xb9980012U, 0xa0833153U, 0x8bae6290U,
+        0x92b553d1U, 0xddf4c516U, 0xc4eff457U, 0xefc2a794U, 0xf6d996d5U,
+        0xae07bce9U, 0xb71c8da8U, 0x9c31de6bU, 0x852aef2aU, 0xca6b79edU,
+        0xd37048acU, 0xf85d1b6fU, 0xe1462a2eU, 0x66de36e1U, 0x7fc507a0U,
+        0x54e85463U, 0x4df36522U, 0x02b2f3e5U, 0x1ba9c2a4U, 0x30849167U,
+        0x299fa026U, 0xe4c5aeb8U, 0xfdde9ff9U, 0xd6f3cc3aU, 0xcfe8fd7bU,
+        0x80a96bbcU, 0x99b25afdU, 0xb29f093eU, 0xab84387fU, 0x2c1c24b0U,
+        0x350715f1U, 0x1e2a4632U, 0x07317773U, 0x4870e1b4U, 0x516bd0f5U,
+        0x7a468336U, 0x635db277U, 0xcbfad74eU, 0xd2e1e60fU, 0xf9ccb5ccU,
+        0xe0d7848dU, 0xaf96124aU, 0xb68d230bU, 0x9da070c8U, 0x84bb4189U,
+        0x03235d46U, 0x1a386c07U, 0x31153fc4U, 0x280e0e85U, 0x674f9842U,
+        0x7e54a903U, 0x5579fac0U, 0x4c62cb81U, 0x8138c51fU, 0x9823f45eU,
+        0xb30ea79dU, 0xaa1596dcU, 0xe554001bU, 0xfc4f315aU, 0xd7626299U,
+        0xce7953d8U, 0x49e14f17U, 0x50fa7e56U, 0x7bd72d95U, 0x62cc1cd4U,
+        0x2d8d8a13U, 0x3496bb52U, 0x1fbbe891U, 0x06a0d9d0U, 0x5e7ef3ecU,
+        0x4765c2adU, 0x6c48916eU, 0x7553a02fU, 0x3a1236e8U, 0x230907a9U,
+        0x0824546aU, 0x113f652bU, 0x96a779e4U, 0x8fbc48a5U, 0xa4911b66U,
+        0xbd8a2a27U, 0xf2cbbce0U, 0xebd08da1U, 0xc0fdde62U, 0xd9e6ef23U,
+        0x14bce1bdU, 0x0da7d0fcU, 0x268a833fU, 0x3f91b27eU, 0x70d024b9U,
+        0x69cb15f8U, 0x42e6463bU, 0x5bfd777aU, 0xdc656bb5U, 0xc57e5af4U,
+        0xee530937U, 0xf7483876U, 0xb809aeb1U, 0xa1129ff0U, 0x8a3fcc33U,
+        0x9324fd72U
+    },
     {
-        return(GZ_NOSPACE);
+        0x00000000U, 0x01c26a37U, 0x0384d46eU, 0x0246be59U, 0x0709a8dcU,
+        0x06cbc2ebU, 0x048d7cb2U, 0x054f1685U, 0x0e1351b8U, 0x0fd13b8fU,
+        0x0d9785d6U, 0x0c55efe1U, 0x091af964U, 0x08d89353U, 0x0a9e2d0aU,
+        0x0b5c473dU, 0x1c26a370U, 0x1de4c947U, 0x1fa2771eU, 0x1e601d29U,
+        0x1b2f0bacU, 0x1aed619bU, 0x18abdfc2U, 0x1969b5f5U, 0x1235f2c8U,
+        0x13f798ffU, 0x11b126a6U, 0x10734c91U, 0x153c5a14U, 0x14fe3023U,
+        0x16b88e7aU, 0x177ae44dU, 0x384d46e0U, 0x398f2cd7U, 0x3bc9928eU,
+        0x3a0bf8b9U, 0x3f44ee3cU, 0x3e86840bU, 0x3cc03a52U, 0x3d025065U,
+        0x365e1758U, 0x379c7d6fU, 0x35dac336U, 0x3418a901U, 0x3157bf84U,
+        0x3095d5b3U, 0x32d36beaU, 0x331101ddU, 0x246be590U, 0x25a98fa7U,
+        0x27ef31feU, 0x262d5bc9U, 0x23624d4cU, 0x22a0277bU, 0x20e69922U,
+        0x2124f315U, 0x2a78b428U, 0x2bbade1fU, 0x29fc6046U, 0x283e0a71U,
+        0x2d711cf4U, 0x2cb376c3U, 0x2ef5c89aU, 0x2f37a2adU, 0x709a8dc0U,
+        0x7158e7f7U, 0x731e59aeU, 0x72dc3399U, 0x7793251cU, 0x76514f2bU,
+        0x7417f172U, 0x75d59b45U, 0x7e89dc78U, 0x7f4bb64fU, 0x7d0d0816U,
+        0x7ccf6221U, 0x798074a4U, 0x78421e93U, 0x7a04a0caU, 0x7bc6cafdU,
+        0x6cbc2eb0U, 0x6d7e4487U, 0x6f38fadeU, 0x6efa90e9U, 0x6bb5866cU,
+        0x6a77ec5bU, 0x68315202U, 0x69f33835U, 0x62af7f08U, 0x636d153fU,
+        0x612bab66U, 0x60e9c151U, 0x65a6d7d4U, 0x6464bde3U, 0x662203baU,
+        0x67e0698dU, 0x48d7cb20U, 0x4915a117U, 0x4b531f4eU, 0x4a917579U,
+        0x4fde63fcU, 0x4e1c09cbU, 0x4c5ab792U, 0x4d98dda5U, 0x46c49a98U,
+        0x4706f0afU, 0x45404ef6U, 0x448224c1U, 0x41cd3244U, 0x400f5873U,
+        0x4249e62aU, 0x438b8c1dU, 0x54f16850U, 0x55330267U, 0x5775bc3eU,
+        0x56b7d609U, 0x53f8c08cU, 0x523aaabbU, 0x507c14e2U, 0x51be7ed5U,
+        0x5ae239e8U, 0x5b2053dfU, 0x5966ed86U, 0x58a487b1U, 0x5deb9134U,
+        0x5c29fb03U, 0x5e6f455aU, 0x5fad2f6dU, 0xe1351b80U, 0xe0f771b7U,
+        0xe2b1cfeeU, 0xe373a5d9U, 0xe63cb35cU, 0xe7fed96bU, 0xe5b86732U,
+        0xe47a0d05U, 0xef264a38U, 0xeee4200fU, 0xeca29e56U, 0xed60f461U,
+        0xe82fe2e4U, 0xe9ed88d3U, 0xebab368aU, 0xea695cbdU, 0xfd13b8f0U,
+        0xfcd1d2c7U, 0xfe976c9eU, 0xff5506a9U, 0xfa1a102cU, 0xfbd87a1bU,
+        0xf99ec442U, 0xf85cae75U, 0xf300e948U, 0xf2c2837fU, 0xf0843d26U,
+        0xf1465711U, 0xf4094194U, 0xf5cb2ba3U, 0xf78d95faU, 0xf64fffcdU,
+        0xd9785d60U, 0xd8ba3757U, 0xdafc890eU, 0xdb3ee339U, 0xde71f5bcU,
+        0xdfb39f8bU, 0xddf521d2U, 0xdc374be5U, 0xd76b0cd8U, 0xd6a966efU,
+        0xd4efd8b6U, 0xd52db281U, 0xd062a404U, 0xd1a0ce33U, 0xd3e6706aU,
+        0xd2241a5dU, 0xc55efe10U, 0xc49c9427U, 0xc6da2a7eU, 0xc7184049U,
+        0xc25756ccU, 0xc3953cfbU, 0xc1d382a2U, 0xc011e895U, 0xcb4dafa8U,
+        0xca8fc59fU, 0xc8c97bc6U, 0xc90b11f1U, 0xcc440774U, 0xcd866d43U,
+        0xcfc0d31aU, 0xce02b92dU, 0x91af9640U, 0x906dfc77U, 0x922b422eU,
+        0x93e92819U, 0x96a63e9cU, 0x976454abU, 0x9522eaf2U, 0x94e080c5U,
+        0x9fbcc7f8U, 0x9e7eadcfU, 0x9c381396U, 0x9dfa79a1U, 0x98b56f24U,
+        0x99770513U, 0x9b31bb4aU, 0x9af3d17dU, 0x8d893530U, 0x8c4b5f07U,
+        0x8e0de15eU, 0x8fcf8b69U, 0x8a809decU, 0x8b42f7dbU, 0x89044982U,
+        0x88c623b5U, 0x839a6488U, 0x82580ebfU, 0x801eb0e6U, 0x81dcdad1U,
+        0x8493cc54U, 0x8551a663U, 0x8717183aU, 0x86d5720dU, 0xa9e2d0a0U,
+        0xa820ba97U, 0xaa6604ceU, 0xaba46ef9U, 0xaeeb787cU, 0xaf29124bU,
+        0xad6fac12U, 0xacadc625U, 0xa7f18118U, 0xa633eb2fU, 0xa4755576U,
+        0xa5b73f41U, 0xa0f829c4U, 0xa13a43f3U, 0xa37cfdaaU, 0xa2be979dU,
+        0xb5c473d0U, 0xb40619e7U, 0xb640a7beU, 0xb782cd89U, 0xb2cddb0cU,
+        0xb30fb13bU, 0xb1490f62U, 0xb08b6555U, 0xbbd72268U, 0xba15485fU,
+        0xb853f606U, 0xb9919c31U, 0xbcde8ab4U, 0xbd1ce083U, 0xbf5a5edaU,
+        0xbe9834edU
+    },
+    {
+        0x00000000U, 0xb8bc6765U, 0xaa09c88bU, 0x12b5afeeU, 0x8f629757U,
+        0x37def032U, 0x256b5fdcU, 0x9dd738b9U, 0xc5b428efU, 0x7d084f8aU,
+        0x6fbde064U, 0xd7018701U, 0x4ad6bfb8U, 0xf26ad8ddU, 0xe0df7733U,
+        0x58631056U, 0x5019579fU, 0xe8a530faU, 0xfa109f14U, 0x42acf871U,
+        0xdf7bc0c8U, 0x67c7a7adU, 0x75720843U, 0xcdce6f26U, 0x95ad7f70U,
+        0x2d111815U, 0x3fa4b7fbU, 0x8718d09eU, 0x1acfe827U, 0xa2738f42U,
+        0xb0c620acU, 0x087a47c9U, 0xa032af3eU, 0x188ec85bU, 0x0a3b67b5U,
+        0xb28700d0U, 0x2f503869U, 0x97ec5f0cU, 0x8559f0e2U, 0x3de59787U,
+        0x658687d1U, 0xdd3ae0b4U, 0xcf8f4f5aU, 0x7733283fU, 0xeae41086U,
+        0x525877e3U, 0x40edd80dU, 0xf851bf68U, 0xf02bf8a1U, 0x48979fc4U,
+        0x5a22302aU, 0xe29e574fU, 0x7f496ff6U, 0xc7f50893U, 0xd540a77dU,
+        0x6dfcc018U, 0x359fd04eU, 0x8d23b72bU, 0x9f9618c5U, 0x272a7fa0U,
+        0xbafd4719U, 0x0241207cU, 0x10f48f92U, 0xa848e8f7U, 0x9b14583dU,
+        0x23a83f58U, 0x311d90b6U, 0x89a1f7d3U, 0x1476cf6aU, 0xaccaa80fU,
+        0xbe7f07e1U, 0x06c36084U, 0x5ea070d2U, 0xe61c17b7U, 0xf4a9b859U,
+        0x4c15df3cU, 0xd1c2e785U, 0x697e80e0U, 0x7bcb2f0eU, 0xc377486bU,
+        0xcb0d0fa2U, 0x73b168c7U, 0x6104c729U, 0xd9b8a04cU, 0x446f98f5U,
+        0xfcd3ff90U, 0xee66507eU, 0x56da371bU, 0x0eb9274dU, 0xb6054028U,
+        0xa4b0efc6U, 0x1c0c88a3U, 0x81dbb01aU, 0x3967d77fU, 0x2bd27891U,
+        0x936e1ff4U, 0x3b26f703U, 0x839a9066U, 0x912f3f88U, 0x299358edU,
+        0xb4446054U, 0x0cf80731U, 0x1e4da8dfU, 0xa6f1cfbaU, 0xfe92dfecU,
+        0x462eb889U, 0x549b1767U, 0xec277002U, 0x71f048bbU, 0xc94c2fdeU,
+        0xdbf98030U, 0x6345e755U, 0x6b3fa09cU, 0xd383c7f9U, 0xc1366817U,
+        0x798a0f72U, 0xe45d37cbU, 0x5ce150aeU, 0x4e54ff40U, 0xf6e89825U,
+        0xae8b8873U, 0x1637ef16U, 0x048240f8U, 0xbc3e279dU, 0x21e91f24U,
+        0x99557841U, 0x8be0d7afU, 0x335cb0caU, 0xed59b63bU, 0x55e5d15eU,
+        0x47507eb0U, 0xffec19d5U, 0x623b216cU, 0xda874609U, 0xc832e9e7U,
+        0x708e8e82U, 0x28ed9ed4U, 0x9051f9b1U, 0x82e4565fU, 0x3a58313aU,
+        0xa78f0983U, 0x1f336ee6U, 0x0d86c108U, 0xb53aa66dU, 0xbd40e1a4U,
+        0x05fc86c1U, 0x1749292fU, 0xaff54e4aU, 0x322276f3U, 0x8a9e1196U,
+        0x982bbe78U, 0x2097d91dU, 0x78f4c94bU, 0xc048ae2eU, 0xd2fd01c0U,
+        0x6a4166a5U, 0xf7965e1cU, 0x4f2a3979U, 0x5d9f9697U, 0xe523f1f2U,
+        0x4d6b1905U, 0xf5d77e60U, 0xe762d18eU, 0x5fdeb6ebU, 0xc2098e52U,
+        0x7ab5e937U, 0x680046d9U, 0xd0bc21bcU, 0x88df31eaU, 0x3063568fU,
+        0x22d6f961U, 0x9a6a9e04U, 0x07bda6bdU, 0xbf01c1d8U, 0xadb46e36U,
+        0x15080953U, 0x1d724e9aU, 0xa5ce29ffU, 0xb77b8611U, 0x0fc7e174U,
+        0x9210d9cdU, 0x2aacbea8U, 0x38191146U, 0x80a57623U, 0xd8c66675U,
+        0x607a0110U, 0x72cfaefeU, 0xca73c99bU, 0x57a4f122U, 0xef189647U,
+        0xfdad39a9U, 0x45115eccU, 0x764dee06U, 0xcef18963U, 0xdc44268dU,
+        0x64f841e8U, 0xf92f7951U, 0x41931e34U, 0x5326b1daU, 0xeb9ad6bfU,
+        0xb3f9c6e9U, 0x0b45a18cU, 0x19f00e62U, 0xa14c6907U, 0x3c9b51beU,
+        0x842736dbU, 0x96929935U, 0x2e2efe50U, 0x2654b999U, 0x9ee8defcU,
+        0x8c5d7112U, 0x34e11677U, 0xa9362eceU, 0x118a49abU, 0x033fe645U,
+        0xbb838120U, 0xe3e09176U, 0x5b5cf613U, 0x49e959fdU, 0xf1553e98U,
+        0x6c820621U, 0xd43e6144U, 0xc68bceaaU, 0x7e37a9cfU, 0xd67f4138U,
+        0x6ec3265dU, 0x7c7689b3U, 0xc4caeed6U, 0x591dd66fU, 0xe1a1b10aU,
+        0xf3141ee4U, 0x4ba87981U, 0x13cb69d7U, 0xab770eb2U, 0xb9c2a15cU,
+        0x017ec639U, 0x9ca9fe80U, 0x241599e5U, 0x36a0360bU, 0x8e1c516eU,
+        0x866616a7U, 0x3eda71c2U, 0x2c6fde2cU, 0x94d3b949U, 0x090481f0U,
+        0xb1b8e695U, 0xa30d497bU, 0x1bb12e1eU, 0x43d23e48U, 0xfb6e592dU,
+        0xe9dbf6c3U, 0x516791a6U, 0xccb0a91fU, 0x740cce7aU, 0x66b96194U,
+        0xde0506f1U
     }
+};
 
-    htll = gz_htll_;
-    htdist = gz_htdist_;
-    htclen = gz_htclen_;
+unsigned int
+gzcrc32(unsigned int crc, void *data, unsigned int size)
+{
+    unsigned char *p;
 
-    ins.mask = 1;
-    ins.src = (unsigned char *)in;
-    ins.srcend = (unsigned char *)in + insize;
-    ins.ptr = ins.src;
-    ins.buf = *ins.ptr++;
+    p = (unsigned char *)data;
+    crc = ~crc;
 
-    magic[0] = (unsigned char)gz_readbits(&ins, 8);
-    magic[1] = (unsigned char)gz_readbits(&ins, 8);
-    if(magic[0] != 0x1f || magic[1] != 0x8b)
+    while(size >= 4)
     {
-        return(GZ_INVMAGIC);
+        crc ^= (unsigned int)p[0] |
+               ((unsigned int)p[1] << 8) |
+               ((unsigned int)p[2] << 16) |
+               ((unsigned int)p[3] << 24);
+        crc = gz_crctable_[3][crc & 0xff] ^
+              gz_crctable_[2][(crc >> 8) & 0xff] ^
+              gz_crctable_[1][(crc >> 16) & 0xff] ^
+              gz_crctable_[0][crc >> 24];
+        p += 4;
+        size -= 4;
     }
 
-    cm = gz_readbits(&ins, 8);
-    if(cm != 8)
+    while(size > 0)
     {
-        return(GZ_INVCMETHOD);
+        crc = gz_crctable_[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        --size;
     }
 
-    flags = gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
-    gz_readbits(&ins, 8);
+    return(~crc);
+}
 
-    if(flags & FEXTRA)
+/* a(x) * b(x) mod p(x), bit-reflected */
+static unsigned int
+gz_multmodp(unsigned int a, unsigned int b)
+{
+    unsigned int m, p;
+
+    m = 1U << 31;
+    p = 0;
+    while(m)
     {
-        xlen = gz_readbits(&ins, 2*8);
-        for(i = 0;
-            i < xlen;
-            ++i)
+        if(a & m)
         {
-            gz_readbits(&ins, 8);
+            p ^= b;
+            if((a & (m - 1)) == 0)
+            {
+                break;
+            }
         }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ GZ_CRC_POLY : (b >> 1);
     }
 
-    if(flags & FNAME)
+    return(p);
+}
+
+unsigned int
+gzcrc32combine(unsigned int crc1, unsigned int crc2, unsigned int size2)
+{
+    unsigned int p, sq;
+
+    /* x^(8*size2) mod p(x), by squaring x^8 */
+    p = 1U << 31;
+    sq = 1U << 23;
+    while(size2)
     {
-        i = gz_readbits(&ins, 8);
-        while(i)
+        if(size2 & 1)
         {
-            i = gz_readbits(&ins, 8);
+            p = gz_multmodp(sq, p);
         }
+        sq = gz_multmodp(sq, sq);
+        size2 >>= 1;
     }
 
-    if(flags & FCOMMENT)
+    return(gz_multmodp(p, crc1) ^ crc2);
+}
+
+typedef struct
+gz_crcpart
+{
+    unsigned char *data;
+    unsigned int size;
+    unsigned int per;
+    unsigned int nparts;
+    unsigned int crc[GZ_PAR_MAX];
+} gz_crcpart;
+
+static unsigned int
+gz_crcpartsize(gz_crcpart *cp, unsigned int index)
+{
+    return((index + 1 < cp->nparts) ? cp->per : cp->size - index * cp->per);
+}
+
+static void
+gz_crctask(void *arg, unsigned int index)
+{
+    gz_crcpart *cp;
+
+    cp = (gz_crcpart *)arg;
+    cp->crc[index] = gzcrc32(
+        0, cp->data + index * cp->per, gz_crcpartsize(cp, index));
+}
+
+unsigned int
+gzcrc32par(
+    unsigned int crc, void *data, unsigned int size,
+    gz_runfn run, void *user)
+{
+    gz_crcpart cp;
+    unsigned int i;
+
+    cp.nparts = size / GZ_CRC_PARMIN;
+    if(cp.nparts > GZ_PAR_MAX)
     {
-        i = gz_readbits(&ins, 8);
-        while(i)
-        {
-            i = gz_readbits(&ins, 8);
-        }
+        cp.nparts = GZ_PAR_MAX;
     }
 
-    if(flags & FHCRC)
+    if(!run || cp.nparts < 2)
     {
-        gz_readbits(&ins, 2*8);
+        return(gzcrc32(crc, data, size));
     }
 
-    islast = 0;
-    while(!islast)
+    cp.data = (unsigned char *)data;
+    cp.size = size;
+    cp.per = size / cp.nparts;
+    run(user, gz_crctask, &cp, cp.nparts);
+
+    for(i = 0;
+        i < cp.nparts;
+        ++i)
     {
-        islast = gz_readbits(&ins, 1);
-        btype = gz_readbits(&ins, 2);
-        todec = 0;
+        crc = gzcrc32combine(crc, cp.crc[i], gz_crcpartsize(&cp, i));
+    }
 
-        if(btype == 0)
-        {
-            /* Emit literals */
-            b0len = gz_readbits(&ins, 8);
-            b0nlen = gz_readbits(&ins, 8);
-            if(b0len != ~b0nlen)
-            {
-                return(GZ_INVFILE);
-            }
+    return(crc);
+}
 
-            while(b0len > 0)
-            {
-                EMIT(gz_readbits(&ins, 8));
-                --b0len;
-            }
-        }
-        else if(btype == 1)
-        {
-            /* Fixed Huffman tables */
-            for(i = 0;
-                i <= 143;
-                ++i)
-            {
-                arrll[i] = 8;
-            }
+#undef GZ_CRC_POLY
 
-            for(i = 144;
-                i <= 255;
-                ++i)
-            {
-                arrll[i] = 9;
-            }
+/* Adler-32 as used by the zlib trailer; start with adler = 1 */
+unsigned int
+gzadler32(unsigned int adler, void *data, unsigned int size)
+{
+    unsigned char *p;
+    unsigned int a, b, n;
+
+    p = (unsigned char *)data;
+    a = adler & 0xffff;
+    b = adler >> 16;
+
+    while(size > 0)
+    {
+        /* largest n such that b cannot overflow before the modulo */
+        n = (size < 5552) ? size : 5552;
+        size -= n;
+        while(n > 0)
+        {
+            a += *p++;
+            b += a;
+            --n;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return((b << 16) | a);
+}
+
+/* Where decoded bytes go. start is where back-references must stop and
+   flushp is the first byte not yet handed to the sink and checksums.
+   With cmp set, the buffer holds the expected output and is only read:
+   every decoded byte is compared against it instead of stored. Since
+   the compared prefix equals the decoded one, back-references can
+   still be resolved from it.
+   With window set, base is a sliding window: once it fills up, all but
+   the last GZ_WINDOW bytes are flushed and dropped (slid counts them),
+   the rest moved to the front. With align set as well, the sink only
+   gets whole pages of align bytes, up to sinkp, and release is called
+   before bytes it has seen are overwritten. */
+typedef struct
+gz_out
+{
+    unsigned char *base;
+    unsigned char *start;
+    unsigned char *ptr;
+    unsigned char *end;
+    unsigned char *flushp;
+    gz_sinkfn sink;
+    void *user;
+    int cmp;
+    int check;
+    unsigned int crc;
+    unsigned int adler;
+    int window;
+    unsigned int slid;
+    /* bytes moved out of the window so far, low and high words */
+    unsigned int slidhi;
+    unsigned int align;
+    unsigned char *sinkp;
+    gz_releasefn release;
+    /* optional: points are recorded here, with input offsets counted
+       from idxin, which is idxoff bytes into the compressed data */
+    gz_index *idx;
+    unsigned char *idxin;
+    unsigned int idxoff;
+    /* with a gz_resume, stop with GZ_END at the first place to resume
+       from at or past this much output */
+    unsigned int limit;
+    /* optional, not with window: a member's CRC is computed once it is
+       complete, with gzcrc32par() */
+    gz_runfn run;
+    void *runuser;
+} gz_out;
+
+#define GZ_CHECK_NONE 0
+#define GZ_CHECK_CRC 1
+#define GZ_CHECK_ADLER 2
+
+static void
+gz_outinit(
+    gz_out *o, void *out, unsigned int outsize,
+    gz_sinkfn sink, void *user, int cmp)
+{
+    o->base = (unsigned char *)out;
+    o->start = o->base;
+    o->ptr = o->start;
+    o->end = o->start + outsize;
+    o->flushp = o->start;
+    o->sink = sink;
+    o->user = user;
+    o->cmp = cmp;
+    o->check = GZ_CHECK_CRC;
+    o->crc = 0;
+    o->adler = 1;
+    o->window = 0;
+    o->slid = 0;
+    o->slidhi = 0;
+    o->align = 0;
+    o->sinkp = o->start;
+    o->release = 0;
+    o->idx = 0;
+    o->idxin = 0;
+    o->idxoff = 0;
+    o->limit = 0xffffffffU;
+    o->run = 0;
+    o->runuser = 0;
+}
+
+/* Bytes produced since gz_outinit */
+static unsigned int
+gz_outpos(gz_out *o)
+{
+    return(o->slid + (unsigned int)(o->ptr - o->base));
+}
+
+/* High word of the bytes produced, for windows past 4 GiB */
+static unsigned int
+gz_outposhi(gz_out *o)
+{
+    return(o->slidhi + (gz_outpos(o) < o->slid));
+}
+
+/* Keep only the last GZ_WINDOW bytes of a window, at its front; the
+   rest must have been flushed. Returns non-zero if release aborts. */
+static int
+gz_slide(gz_out *o)
+{
+    unsigned char *from;
+    unsigned int keep, drop, i;
+
+    keep = (unsigned int)(o->ptr - o->base);
+    if(keep > GZ_WINDOW)
+    {
+        keep = GZ_WINDOW;
+    }
+
+    from = o->ptr - keep;
+    if(o->align)
+    {
+        /* Move whole pages, so they stay aligned, and keep what the
+           sink has not had yet */
+        if(from > o->sinkp)
+        {
+            from = o->sinkp;
+        }
+        from = o->base + ((unsigned int)(from - o->base) & ~(o->align - 1));
+        keep = (unsigned int)(o->ptr - from);
+
+        if(from > o->base && o->release && o->release(o->user))
+        {
+            return(1);
+        }
+        o->sinkp -= from - o->base;
+    }
+
+    drop = (unsigned int)(from - o->base);
+    for(i = 0;
+        i < keep;
+        ++i)
+    {
+        o->base[i] = from[i];
+    }
+
+    o->slid += drop;
+    if(o->slid < drop)
+    {
+        ++o->slidhi;
+    }
+    o->ptr -= drop;
+    o->flushp -= drop;
+    o->start = ((unsigned int)(o->start - o->base) > drop) ?
+        o->start - drop : o->base;
+
+    return(0);
+}
+
+/* Filters of gzindexsearch(): GZ_BLOOMK bits per trigram, picked by a
+   double hash of its three bytes */
+#define GZ_BLOOMK 3
+
+static unsigned char *
+gz_chunkbloom(gz_index *idx, unsigned int k)
+{
+    return(idx->blooms + (unsigned long)k * idx->bloomsize);
+}
+
+static unsigned int
+gz_bloomhash(unsigned int g, unsigned int *step)
+{
+    unsigned int h;
+
+    h = g * 0x9e3779b1U;
+    h ^= h >> 15;
+    h *= 0x85ebca77U;
+    h ^= h >> 13;
+    *step = (h >> 17 | h << 15) | 1;
+    return(h);
+}
+
+static int
+gz_bloomhas(gz_index *idx, unsigned int k, unsigned int g)
+{
+    unsigned char *bloom;
+    unsigned int mask, h, step, i;
+
+    bloom = gz_chunkbloom(idx, k);
+    mask = idx->bloomsize * 8 - 1;
+    h = gz_bloomhash(g, &step);
+    for(i = 0;
+        i < GZ_BLOOMK;
+        ++i)
+    {
+        if(!(bloom[(h & mask) >> 3] & (1 << (h & 7))))
+        {
+            return(0);
+        }
+        h += step;
+    }
+
+    return(1);
+}
+
+/* Add the trigrams ending in the size bytes at p, output of o, to the
+   filter of the chunk after the last point */
+static void
+gz_bloomadd(gz_out *o, unsigned char *p, unsigned int size)
+{
+    unsigned char *bloom;
+    unsigned int mask, g, n, h, step, i, j;
+
+    bloom = gz_chunkbloom(o->idx, o->idx->npoints);
+    mask = o->idx->bloomsize * 8 - 1;
+    n = (p - o->base < 2) ? (unsigned int)(p - o->base) : 2;
+    g = 0;
+    for(i = n;
+        i > 0;
+        --i)
+    {
+        g = (g << 8) | *(p - i);
+    }
+
+    for(i = 0;
+        i < size && n < 2;
+        ++i, ++n)
+    {
+        g = (g << 8) | p[i];
+    }
+
+    for(;
+        i < size;
+        ++i)
+    {
+        g = ((g << 8) | p[i]) & 0xffffff;
+        h = gz_bloomhash(g, &step);
+        for(j = 0;
+            j < GZ_BLOOMK;
+            ++j)
+        {
+            bloom[(h & mask) >> 3] |= (unsigned char)(1 << (h & 7));
+            h += step;
+        }
+    }
+}
+
+static void
+gz_bloomclear(gz_index *idx, unsigned int k)
+{
+    unsigned char *bloom;
+    unsigned int i;
+
+    bloom = gz_chunkbloom(idx, k);
+    for(i = 0;
+        i < idx->bloomsize;
+        ++i)
+    {
+        bloom[i] = 0;
+    }
+}
+
+static int
+gz_flush(gz_out *o)
+{
+    unsigned char *p;
+    unsigned int size;
+
+    if(o->ptr <= o->flushp)
+    {
+        return(0);
+    }
+
+    p = o->flushp;
+    size = (unsigned int)(o->ptr - p);
+    o->flushp = o->ptr;
+
+    if(o->check == GZ_CHECK_CRC)
+    {
+        o->crc = gzcrc32(o->crc, p, size);
+    }
+    else if(o->check == GZ_CHECK_ADLER)
+    {
+        o->adler = gzadler32(o->adler, p, size);
+    }
+
+    if(o->idx && o->idx->blooms)
+    {
+        gz_bloomadd(o, p, size);
+    }
+
+    if(o->align)
+    {
+        /* Whole pages only; the partial one goes out when it is full */
+        p = o->sinkp;
+        o->sinkp = o->base +
+            ((unsigned int)(o->ptr - o->base) & ~(o->align - 1));
+        size = (unsigned int)(o->sinkp - p);
+        if(size == 0)
+        {
+            return(0);
+        }
+    }
+
+    if(o->sink && o->sink(o->user, p, size))
+    {
+        return(1);
+    }
+
+    return(0);
+}
+
+static unsigned char *
+gz_pointwin(gz_index *idx, unsigned int i)
+{
+    return(idx->windows + (unsigned long)i * GZ_WINDOW);
+}
+
+/* Append a point with the last winsize bytes before win + winsize as
+   its history, no more than GZ_WINDOW or out; win may be in the slot
+   of the new point */
+static int
+gz_indexadd(
+    gz_index *idx, unsigned int out, unsigned int in,
+    unsigned char *win, unsigned int winsize)
+{
+    gz_point *pt;
+    unsigned char *dst;
+    unsigned int i;
+
+    if(idx->npoints && out < idx->points[idx->npoints - 1].out)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(idx->npoints == idx->maxpoints)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    if(winsize > GZ_WINDOW)
+    {
+        win += winsize - GZ_WINDOW;
+        winsize = GZ_WINDOW;
+    }
+    if(winsize > out)
+    {
+        win += winsize - out;
+        winsize = out;
+    }
+
+    if(winsize > 0)
+    {
+        if(!idx->windows)
+        {
+            return(GZ_NOSPACE);
+        }
+
+        dst = gz_pointwin(idx, idx->npoints);
+        for(i = 0;
+            i < winsize;
+            ++i)
+        {
+            dst[i] = win[i];
+        }
+    }
+
+    pt = &idx->points[idx->npoints++];
+    pt->out = out;
+    pt->in = in;
+    pt->winsize = winsize;
+    if(idx->blooms)
+    {
+        gz_bloomclear(idx, idx->npoints);
+    }
+
+    return(GZ_OK);
+}
+
+/* Drop every other point of a full index and double its spacing */
+static void
+gz_indexthin(gz_index *idx)
+{
+    unsigned char *src, *dst;
+    unsigned int i, n, j;
+
+    n = 0;
+    for(i = 1;
+        i < idx->npoints;
+        i += 2)
+    {
+        idx->points[n] = idx->points[i];
+        src = (idx->points[i].winsize > 0) ? gz_pointwin(idx, i) : 0;
+        dst = (idx->points[i].winsize > 0) ? gz_pointwin(idx, n) : 0;
+        for(j = 0;
+            j < idx->points[i].winsize;
+            ++j)
+        {
+            dst[j] = src[j];
+        }
+        ++n;
+    }
+
+    /* Chunk i of the new points is chunks 2i and 2i + 1 of the old */
+    if(idx->blooms)
+    {
+        for(i = 0;
+            i <= n;
+            ++i)
+        {
+            src = gz_chunkbloom(idx, 2*i);
+            dst = gz_chunkbloom(idx, i);
+            for(j = 0;
+                j < idx->bloomsize;
+                ++j)
+            {
+                dst[j] = src[j];
+                if(2*i + 1 <= idx->npoints)
+                {
+                    dst[j] |= src[idx->bloomsize + j];
+                }
+            }
+        }
+    }
+
+    idx->npoints = n;
+    idx->spacing = (idx->spacing > 0x7fffffffU) ?
+        0xffffffffU : 2 * idx->spacing;
+}
+
+/* Record a point at the output of o so far, flushed up to o->ptr, if
+   it is at least spacing past the last one. Its input is bit bit of
+   the byte at in. At a gzip header (head) no history is needed;
+   elsewhere it is the member's output up to GZ_WINDOW. Points hold bit
+   offsets and output offsets in 32 bits, so past 512 MiB of input or
+   4 GiB of output, or once a point cannot be added, recording stops
+   and the index is marked truncated; the decode goes on regardless. */
+static void
+gz_indexmark(gz_out *o, unsigned char *in, unsigned int bit, int head)
+{
+    gz_index *idx;
+    unsigned int pos, last, at;
+
+    idx = o->idx;
+    if(idx->truncated)
+    {
+        return;
+    }
+
+    at = (unsigned int)(in - o->idxin);
+    if(at > 0x1fffffffU || o->idxoff > 0x1fffffffU - at ||
+       gz_outposhi(o))
+    {
+        idx->truncated = 1;
+        return;
+    }
+
+    pos = gz_outpos(o);
+    last = idx->npoints ? idx->points[idx->npoints - 1].out : 0;
+    if(pos - last < idx->spacing)
+    {
+        return;
+    }
+
+    if(idx->npoints == idx->maxpoints)
+    {
+        gz_indexthin(idx);
+        last = idx->npoints ? idx->points[idx->npoints - 1].out : 0;
+        if(idx->npoints == idx->maxpoints || pos - last < idx->spacing)
+        {
+            return;
+        }
+    }
+
+    if(gz_indexadd(idx, pos, (o->idxoff + at) * 8 + bit, o->start,
+                   head ? 0 : (unsigned int)(o->ptr - o->start)) != GZ_OK)
+    {
+        idx->truncated = 1;
+    }
+}
+
+/* Start recording idx, if any, for a whole decode of in into o */
+static void
+gz_indexstart(gz_out *o, gz_index *idx, void *in)
+{
+    if(!idx)
+    {
+        return;
+    }
+
+    idx->npoints = 0;
+    idx->truncated = 0;
+    if(idx->blooms)
+    {
+        gz_bloomclear(idx, 0);
+    }
+    o->idx = idx;
+    o->idxin = (unsigned char *)in;
+}
+
+static void
+gz_bsinit(gz_bstream *stream, unsigned char *src, unsigned int size)
+{
+    stream->src = src;
+    stream->srcend = src + size;
+    stream->ptr = src;
+    stream->mask = 1;
+    stream->end = 0;
+    stream->overrun = 0;
+    stream->refill = 0;
+    stream->user = 0;
+    stream->buf = 0;
+    gz_nextbyte(stream);
+}
+
+/* First byte not yet consumed, after discarding any partial byte */
+static unsigned char *
+gz_bspos(gz_bstream *stream)
+{
+    gz_alignbyte(stream);
+    if(stream->end)
+    {
+        return(stream->srcend);
+    }
+
+    return(stream->ptr - 1);
+}
+
+/* Bit offset of the next bit to be read, from the start of src */
+static unsigned int
+gz_bitpos(gz_bstream *stream)
+{
+    unsigned int bit;
+    unsigned char mask;
+
+    if(stream->end)
+    {
+        return((unsigned int)(stream->srcend - stream->src) * 8);
+    }
+
+    bit = 0;
+    for(mask = stream->mask;
+        mask > 1;
+        mask >>= 1)
+    {
+        ++bit;
+    }
+
+    return((unsigned int)(stream->ptr - 1 - stream->src) * 8 + bit);
+}
+
+/* Continue reading at bit offset pos from the start of src */
+static void
+gz_bsseek(gz_bstream *stream, unsigned int pos)
+{
+    stream->end = 0;
+    stream->overrun = 0;
+    stream->ptr = stream->src + pos / 8;
+    stream->mask = (unsigned char)(1 << (pos % 8));
+    if(stream->ptr >= stream->srcend)
+    {
+        stream->ptr = stream->srcend;
+        stream->end = 1;
+        return;
+    }
+    stream->buf = *stream->ptr++;
+}
+
+#define GZ_LUTBITS 10
+
+/* Fill fast, indexed by the next GZ_LUTBITS bits of input, with
+   symbol << 4 | code length for the codes that fit, 0 elsewhere */
+static void
+gz_fastbuild(unsigned int *lens, unsigned int n, unsigned short *fast)
+{
+    unsigned int count[16], next[16];
+    unsigned int i, len, code, rev, step;
+
+    gz_memset(count, 0, sizeof(count));
+    for(i = 0;
+        i < n;
+        ++i)
+    {
+        if(lens[i] < 16)
+        {
+            ++count[lens[i]];
+        }
+    }
+    count[0] = 0;
+
+    code = 0;
+    for(len = 1;
+        len < 16;
+        ++len)
+    {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    /* Deflate sends codes starting at their top bit, so the table is
+       indexed by the bit-reversed code */
+    gz_memset(fast, 0, sizeof(unsigned short) << GZ_LUTBITS);
+    for(i = 0;
+        i < n;
+        ++i)
+    {
+        len = lens[i];
+        if(len == 0 || len > GZ_LUTBITS)
+        {
+            continue;
+        }
+
+        code = next[len]++;
+        if(code >> len)
+        {
+            continue;
+        }
+
+        rev = 0;
+        for(step = 0;
+            step < len;
+            ++step)
+        {
+            rev |= ((code >> step) & 1) << (len - 1 - step);
+        }
+
+        for(step = rev;
+            step < (1U << GZ_LUTBITS);
+            step += 1U << len)
+        {
+            fast[step] = (unsigned short)((i << 4) | len);
+        }
+    }
+}
+
+/* gz_huffdec() through fast when the code is in it and the input is at
+   hand, walking the tree otherwise */
+static int
+gz_huffsym(gz_bstream *stream, unsigned short *fast, gz_huffn *ht)
+{
+    unsigned int bit, e;
+
+    if(stream->end || stream->srcend - stream->ptr < 2)
+    {
+        return(gz_huffdec(stream, ht));
+    }
+
+    bit = gz_maskbit(stream->mask);
+    e = fast[gz_peekbits(stream, bit) & ((1U << GZ_LUTBITS) - 1)];
+    if(!e)
+    {
+        return(gz_huffdec(stream, ht));
+    }
+
+    gz_dropbits(stream, bit + (e & 15));
+    return((int)(e >> 4));
+}
+
+/* Huffman trees of the block being decoded, their fast tables and the
+   working memory to build them */
+typedef struct
+gz_trees
+{
+    gz_huffn ll[GZ_HTLL_MAX];
+    gz_huffn dist[GZ_HTDIST_MAX];
+    gz_huffn clen[GZ_HTCLEN_MAX];
+    unsigned short llfast[1 << GZ_LUTBITS];
+    unsigned short distfast[1 << GZ_LUTBITS];
+    gz_htscratch scratch;
+} gz_trees;
+
+/* Read the header of a stored block, returns its length or -1 */
+static int
+gz_storedlen(gz_bstream *ins)
+{
+    unsigned int b0len, b0nlen;
+
+    gz_alignbyte(ins);
+    b0len = gz_readbits(ins, 16);
+    b0nlen = gz_readbits(ins, 16);
+    if(b0len != (~b0nlen & 0xffff))
+    {
+        return(-1);
+    }
+
+    return((int)b0len);
+}
+
+/* Code lengths of a block of type 1 (fixed) or 2 (dynamic), read from
+   its header; t only serves to decode the code length codes */
+static int
+gz_blocklens(
+    gz_bstream *ins, unsigned int btype,
+    unsigned int *arrll, unsigned int *arrdist, gz_trees *t)
+{
+#define MAXCLEN GZ_CLEN_MAX
+#define LLLEN GZ_LL_MAX
+#define DISTLEN GZ_DIST_MAX
+
+    unsigned int hlit, hdist, hclen;
+    unsigned int i;
+
+    unsigned int arrclen[MAXCLEN] = {0};
+    unsigned int clenord[MAXCLEN] = {
+        16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15
+    };
+
+    unsigned int arrlens[LLLEN + DISTLEN] = {0};
+
+    if(btype == 1)
+    {
+        /* Fixed Huffman tables */
+        for(i = 0;
+            i <= 143;
+            ++i)
+        {
+            arrll[i] = 8;
+        }
+
+        for(i = 144;
+            i <= 255;
+            ++i)
+        {
+            arrll[i] = 9;
+        }
+
+        for(i = 256;
+            i <= 279;
+            ++i)
+        {
+            arrll[i] = 7;
+        }
+
+        for(i = 280;
+            i <= 287;
+            ++i)
+        {
+            arrll[i] = 8;
+        }
+
+        for(i = 0;
+            i < DISTLEN;
+            ++i)
+        {
+            arrdist[i] = 5;
+        }
+    }
+    else
+    {
+        /* Dynamic Huffman tables */
+        hlit = gz_readbits(ins, 5);
+        hdist = gz_readbits(ins, 5);
+        hclen = gz_readbits(ins, 4);
+
+        if(257 + hlit > LLLEN)
+        {
+            return(0);
+        }
+
+        /* Construct CL Lengths table */
+        for(i = 0;
+            i < MAXCLEN;
+            ++i)
+        {
+            arrclen[clenord[i]] =
+                (i < hclen + 4) ? gz_readbits(ins, 3) : 0;
+        }
+
+        if(!gz_buildht(
+            arrclen, MAXCLEN, t->clen, GZ_HTCLEN_MAX, &t->scratch))
+        {
+            return(0);
+        }
+
+        if(!gz_getlens(ins, arrlens, 257 + hlit + 1 + hdist, t->clen))
+        {
+            return(0);
+        }
+
+        for(i = 0;
+            i < LLLEN;
+            ++i)
+        {
+            arrll[i] = (i < 257 + hlit) ? arrlens[i] : 0;
+        }
+
+        for(i = 0;
+            i < DISTLEN;
+            ++i)
+        {
+            arrdist[i] = (i < 1 + hdist) ? arrlens[257 + hlit + i] : 0;
+        }
+    }
+
+    return(1);
+
+#undef DISTLEN
+#undef LLLEN
+#undef MAXCLEN
+}
+
+/* Set up the trees for a block of type 1 (fixed) or 2 (dynamic) */
+static int
+gz_blocktrees(gz_bstream *ins, unsigned int btype, gz_trees *t)
+{
+#define LLLEN GZ_LL_MAX
+#define DISTLEN GZ_DIST_MAX
+
+    unsigned int arrll[LLLEN] = {0};
+    unsigned int arrdist[DISTLEN] = {0};
+
+    if(!gz_blocklens(ins, btype, arrll, arrdist, t))
+    {
+        return(0);
+    }
+
+    if(!gz_buildht(arrll, LLLEN, t->ll, GZ_HTLL_MAX, &t->scratch))
+    {
+        return(0);
+    }
+
+    if(!gz_buildht(arrdist, DISTLEN, t->dist, GZ_HTDIST_MAX, &t->scratch))
+    {
+        return(0);
+    }
+
+    gz_fastbuild(arrll, LLLEN, t->llfast);
+    gz_fastbuild(arrdist, DISTLEN, t->distfast);
+    return(1);
+
+#undef DISTLEN
+#undef LLLEN
+}
+
+/* Where a decode that ran out of input can pick up again: the bit
+   offset of the next block, or with inblock set, that of the current
+   block's header and of the next symbol in it, and the output up to
+   there. Recorded whenever output is flushed, and before each symbol
+   near the end of the input. */
+typedef struct
+gz_resume
+{
+    int inblock;
+    unsigned int hdrpos;
+    unsigned int pos;
+    unsigned int out;
+} gz_resume;
+
+/* Decode a raw deflate stream (RFC 1951) into o. With rs, running out
+   of input is not an error: o->ptr goes back to the last place recorded
+   in rs, the output up to there is flushed, and GZ_END is returned with
+   rs telling where to continue. The same happens, without going back,
+   once o->limit is reached. */
+static int
+gz_blocks(gz_bstream *ins, gz_out *o, gz_resume *rs)
+{
+#define LLLEN GZ_LL_MAX
+
+#define EMIT(b)\
+    if(outp >= outend)\
+    {\
+        return(cmp ? GZ_MISMATCH : GZ_NOSPACE);\
+    }\
+    if(cmp)\
+    {\
+        if(*outp != (unsigned char)((b) & 0xff))\
+        {\
+            return(GZ_MISMATCH);\
+        }\
+        ++outp;\
+    }\
+    else\
+    {\
+        *outp++ = (unsigned char)((b) & 0xff);\
+    }
+
+#define FLUSH()\
+    o->ptr = outp;\
+    if(gz_flush(o))\
+    {\
+        return(GZ_ABORTED);\
+    }
+
+/* Between two symbols of a Huffman block */
+#define MARK()\
+    if(rs)\
+    {\
+        rs->inblock = 1;\
+        rs->hdrpos = hdrpos;\
+        rs->pos = gz_bitpos(ins);\
+        rs->out = gz_outpos(o);\
+        if(gz_outpos(o) >= o->limit)\
+        {\
+            return(GZ_END);\
+        }\
+    }
+
+/* Make room for the longest match in a full window */
+#define ROOM()\
+    if(window && outend - outp < 258)\
+    {\
+        if(ins->overrun)\
+        {\
+            return(GZ_INVFILE);\
+        }\
+        FLUSH();\
+        if(gz_slide(o))\
+        {\
+            return(GZ_ABORTED);\
+        }\
+        outp = o->ptr;\
+    }
+
+    unsigned int islast, btype, hdrpos;
+    int sym, dist, len;
+    int cmp, window, resume;
+    gz_trees trees;
+
+    unsigned char *outp, *outend, *backp;
+
+    outp = o->ptr;
+    outend = o->end;
+    cmp = o->cmp;
+    window = o->window;
+
+    resume = 0;
+    hdrpos = 0;
+    if(rs)
+    {
+        resume = rs->inblock;
+        rs->out = gz_outpos(o);
+        gz_bsseek(ins, resume ? rs->hdrpos : rs->pos);
+    }
+
+    islast = 0;
+    while(!islast)
+    {
+        if(rs)
+        {
+            hdrpos = gz_bitpos(ins);
+        }
+
+        islast = gz_readbits(ins, 1);
+        btype = gz_readbits(ins, 2);
+
+        if(btype == 0)
+        {
+            /* Emit literals */
+            len = gz_storedlen(ins);
+            if(len < 0 || ins->overrun)
+            {
+                return(GZ_INVFILE);
+            }
+
+            /* Only start on a stored block that is all there, as its
+               output may be flushed before its end */
+            if(rs && (unsigned int)len >
+               ((unsigned int)(ins->srcend - ins->src) * 8 -
+                gz_bitpos(ins)) / 8)
+            {
+                ins->overrun = 1;
+                return(GZ_INVFILE);
+            }
+
+            while(len > 0)
+            {
+                ROOM();
+                EMIT(gz_readbits(ins, 8));
+                --len;
+            }
+        }
+        else if(btype == 1 || btype == 2)
+        {
+            if(!gz_blocktrees(ins, btype, &trees))
+            {
+                return(GZ_INVFILE);
+            }
+
+            if(resume)
+            {
+                gz_bsseek(ins, rs->pos);
+                resume = 0;
+            }
+
+            for(;;)
+            {
+                if(window && outend - outp < 258)
+                {
+                    ROOM();
+                    MARK();
+                }
+
+                /* The last symbols may not be all there: stop as soon as
+                   one ran out, and with rs note where each starts, so
+                   that running out loses no output */
+                if(ins->srcend - ins->ptr < 8)
+                {
+                    if(ins->overrun)
+                    {
+                        return(GZ_INVFILE);
+                    }
+                    if(rs)
+                    {
+                        rs->inblock = 1;
+                        rs->hdrpos = hdrpos;
+                        rs->pos = gz_bitpos(ins);
+                        rs->out = o->slid + (unsigned int)(outp - o->base);
+                    }
+                }
+
+                sym = gz_huffsym(ins, trees.llfast, trees.ll);
+                if(sym == 256)
+                {
+                    break;
+                }
+
+                if(sym < 0 || sym > LLLEN)
+                {
+                    return(GZ_INVFILE);
+                }
+
+                if(sym >= 0 && sym <= 255)
+                {
+                    EMIT(sym);
+                }
+                else if(sym < LLLEN)
+                {
+                    len = gz_getlen(sym, ins);
+                    dist = gz_huffsym(ins, trees.distfast, trees.dist);
+                    dist = gz_getdist(dist, ins);
+
+                    if(dist < 0 || len <= 0)
+                    {
+                        return(GZ_INVFILE);
+                    }
+
+                    if(dist > outp - o->start)
+                    {
+                        return(GZ_INVFILE);
+                    }
+                    backp = outp - dist;
+
+                    if(!cmp && outend - outp >= len)
+                    {
+                        while(len > 0)
+                        {
+                            *outp++ = *backp++;
+                            --len;
+                        }
+                    }
+
+                    while(len > 0)
+                    {
+                        EMIT(*backp);
+                        ++backp;
+                        len -= 1;
+                    }
+                }
+                else
+                {
+                    return(GZ_INVFILE);
+                }
+
+                if(outp - o->flushp >= GZ_CHUNK)
+                {
+                    if(ins->overrun)
+                    {
+                        return(GZ_INVFILE);
+                    }
+
+                    FLUSH();
+                    MARK();
+                }
+            }
+        }
+        else
+        {
+            return(GZ_INVFILE);
+        }
+
+        if(ins->overrun)
+        {
+            return(GZ_INVFILE);
+        }
+
+        FLUSH();
+        if(o->idx && !islast)
+        {
+            gz_indexmark(o, ins->end ? ins->srcend : ins->ptr - 1,
+                         gz_bitpos(ins) % 8, 0);
+        }
+        if(rs)
+        {
+            rs->inblock = 0;
+            rs->pos = gz_bitpos(ins);
+            rs->out = gz_outpos(o);
+            if(!islast && gz_outpos(o) >= o->limit)
+            {
+                return(GZ_END);
+            }
+        }
+    }
+
+    o->ptr = outp;
+    return(GZ_OK);
+
+#undef ROOM
+#undef MARK
+#undef FLUSH
+#undef EMIT
+#undef LLLEN
+}
+
+static int
+gz_inflate(gz_bstream *ins, gz_out *o, gz_resume *rs)
+{
+    int result;
+
+    result = gz_blocks(ins, o, rs);
+    if(result != GZ_OK && result != GZ_ABORTED && rs && ins->overrun)
+    {
+        o->ptr = o->base + (rs->out - o->slid);
+        if(gz_flush(o))
+        {
+            return(GZ_ABORTED);
+        }
+        result = GZ_END;
+    }
+
+    return(result);
+}
+
+/* Skip a gzip header (RFC 1952); *hlen receives its size */
+static int
+gz_gzhead(unsigned char *in, unsigned int insize, unsigned int *hlen)
+{
+#define FTEXT 0x01
+#define FHCRC 0x02
+#define FEXTRA 0x04
+#define FNAME 0x08
+#define FCOMMENT 0x10
+
+    unsigned int flags, xlen, pos;
+
+    if(insize < 18)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(in[0] != 0x1f || in[1] != 0x8b)
+    {
+        return(GZ_INVMAGIC);
+    }
+
+    if(in[2] != 8)
+    {
+        return(GZ_INVCMETHOD);
+    }
+
+    flags = in[3];
+    pos = 10;
+
+    if(flags & FEXTRA)
+    {
+        xlen = (unsigned int)in[pos] | ((unsigned int)in[pos + 1] << 8);
+        pos += 2 + xlen;
+    }
+
+    if(flags & FNAME)
+    {
+        while(pos < insize && in[pos])
+        {
+            ++pos;
+        }
+        ++pos;
+    }
+
+    if(flags & FCOMMENT)
+    {
+        while(pos < insize && in[pos])
+        {
+            ++pos;
+        }
+        ++pos;
+    }
+
+    if(flags & FHCRC)
+    {
+        pos += 2;
+    }
+
+    if(pos + 8 > insize)
+    {
+        return(GZ_INVFILE);
+    }
+
+    *hlen = pos;
+    return(GZ_OK);
+
+#undef FTEXT
+#undef FHCRC
+#undef FEXTRA
+#undef FNAME
+#undef FCOMMENT
+}
+
+/* Decode one gzip member; *used receives its size including the
+   trailer */
+static int
+gz_member(
+    unsigned char *in, unsigned int insize,
+    gz_out *o, unsigned int *used)
+{
+    gz_bstream ins;
+    unsigned char *p;
+    unsigned int hlen, mpos;
+    int result;
+
+    result = gz_gzhead(in, insize, &hlen);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    mpos = gz_outpos(o);
+    o->start = o->ptr;
+    o->check = o->run ? GZ_CHECK_NONE : GZ_CHECK_CRC;
+    o->crc = 0;
+    if(o->idx)
+    {
+        gz_indexmark(o, in, 0, 1);
+    }
+
+    gz_bsinit(&ins, in + hlen, insize - hlen);
+    result = gz_inflate(&ins, o, 0);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    p = gz_bspos(&ins);
+    if(in + insize - p < 8)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(o->run)
+    {
+        o->crc = gzcrc32par(0, o->start, (unsigned int)(o->ptr - o->start),
+                            o->run, o->runuser);
+    }
+
+    if(o->crc != gz_read32le(p))
+    {
+        return(GZ_INVCRC);
+    }
+
+    if(gz_outpos(o) - mpos != gz_read32le(p + 4))
+    {
+        return(GZ_INVFILE);
+    }
+
+    *used = (unsigned int)(p + 8 - in);
+    return(GZ_OK);
+}
+
+/* Decode a zlib stream (RFC 1950) */
+static int
+gz_zlib(unsigned char *in, unsigned int insize, gz_out *o)
+{
+    gz_bstream ins;
+    unsigned char *p;
+    unsigned int adler;
+    int result;
+
+    if(insize < 6 || (in[0] & 0x0f) != 8 || (in[0] >> 4) > 7 ||
+       (((unsigned int)in[0] << 8) | in[1]) % 31 != 0)
+    {
+        return(GZ_INVMAGIC);
+    }
+
+    /* Preset dictionaries are not supported */
+    if(in[1] & 0x20)
+    {
+        return(GZ_INVFILE);
+    }
+
+    o->check = GZ_CHECK_ADLER;
+    o->adler = 1;
+
+    gz_bsinit(&ins, in + 2, insize - 2);
+    result = gz_inflate(&ins, o, 0);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    p = gz_bspos(&ins);
+    if(in + insize - p < 4)
+    {
+        return(GZ_INVFILE);
+    }
+
+    adler = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+            ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+    if(o->adler != adler)
+    {
+        return(GZ_INVCRC);
+    }
+
+    return(GZ_OK);
+}
+
+static int
+gz_iszero(unsigned char *p, unsigned int size)
+{
+    while(size > 0)
+    {
+        if(*p++)
+        {
+            return(0);
+        }
+        --size;
+    }
+
+    return(1);
+}
+
+static int
+gz_decode(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize,
+    gz_sinkfn sink, void *user, int cmp,
+    gz_runfn run, void *runuser, gz_index *idx)
+{
+    gz_out o;
+    unsigned char *p;
+    unsigned int size, used, left;
+    int result;
+
+    if(!in || insize < 18)
+    {
+        return(GZ_INVFILE);
+    }
+
+    /* The trailer only gives the size of the last member, or reads 0
+       when there is zero padding after it */
+    size = gzdecsize(in, insize);
+    if(cmp)
+    {
+        if(outsize < size)
+        {
+            return(GZ_MISMATCH);
+        }
+    }
+    else if(size == 0)
+    {
+        return(GZ_INVFILE);
+    }
+    else if(outsize < size)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    gz_outinit(&o, out, outsize, sink, user, cmp);
+    gz_indexstart(&o, idx, in);
+
+    /* Small members are checksummed chunk by chunk while in cache */
+    if(run && size >= 2*GZ_CRC_PARMIN)
+    {
+        o.run = run;
+        o.runuser = runuser;
+    }
+
+    result = gz_member((unsigned char *)in, insize, &o, &used);
+
+    /* A match needs all members, up to any zero padding, and all of
+       ref */
+    if(cmp && result == GZ_OK)
+    {
+        p = (unsigned char *)in + used;
+        left = insize - used;
+        while(result == GZ_OK && left > 0 && !gz_iszero(p, left))
+        {
+            result = gz_member(p, left, &o, &used);
+            p += used;
+            left -= used;
+        }
+
+        if(result == GZ_OK && o.ptr != o.end)
+        {
+            result = GZ_MISMATCH;
+        }
+    }
+
+    /* The trailer promised enough room, so running out means the stream
+       is corrupt */
+    if(result == GZ_NOSPACE)
+    {
+        result = GZ_INVFILE;
+    }
+
+    if(result == GZ_OK && idx)
+    {
+        idx->size = gz_outpos(&o);
+        idx->insize = insize;
+    }
+
+    return(result);
+}
+
+unsigned int
+gzdecsize(void *in, unsigned int insize)
+{
+    unsigned int decsize;
+    unsigned char *inp;
+
+    if(!in || insize < 18)
+    {
+        return(0);
+    }
+
+    decsize = 0;
+    inp = (unsigned char *)in + insize - 4;
+    decsize |= (unsigned int)*inp++;
+    decsize |= ((unsigned int)*inp++) << 8;
+    decsize |= ((unsigned int)*inp++) << 16;
+    decsize |= ((unsigned int)*inp++) << 24;
+
+    return(decsize);
+}
+
+int
+gzdecsink(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize,
+    gz_sinkfn sink, void *user)
+{
+    return(gz_decode(in, insize, out, outsize, sink, user, 0, 0, 0, 0));
+}
+
+int
+gzdec(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize)
+{
+    return(gz_decode(in, insize, out, outsize, 0, 0, 0, 0, 0, 0));
+}
+
+/* Check whether in decompresses to exactly ref without writing any
+   output. Stops at the first differing byte; all members of in and
+   all of ref must be used for a match. */
+int
+gzdeccmp(
+    void *in, unsigned int insize,
+    void *ref, unsigned int refsize)
+{
+    return(gz_decode(in, insize, ref, refsize, 0, 0, 1, 0, 0, 0));
+}
+
+/* gzdec() that checks the CRC of a large member with gzcrc32par() on
+   several threads once it is decoded, instead of chunk by chunk */
+int
+gzdecpar(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize,
+    gz_runfn run, void *user)
+{
+    return(gz_decode(in, insize, out, outsize, 0, 0, 0, run, user, 0));
+}
+
+/* gzdec() that also records a checkpoint index of in, as gzdecindex()
+   does; the history of each point is already in out */
+int
+gzdecbufindex(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, gz_index *idx)
+{
+    return(gz_decode(in, insize, out, outsize, 0, 0, 0, 0, 0, idx));
+}
+
+/**
+  Two-stage decoding. gzdectok() only runs the Huffman stage: it turns a
+  gzip member into LZ77 tokens and hands them to tokfn in batches of up
+  to bufmax (buf is reused once tokfn returns), and *used receives the
+  size of the member, trailer included. gzresolve() is the other stage:
+  it turns token batches into output, checksumming each batch while it
+  is hot, and gzresend() checks the result against the member's trailer
+  and starts on the next member. Each stage's loop is simpler than the
+  fused one in gzdec(), and the two can run on different cores, with
+  tokfn copying batches into a queue that a second thread drains into
+  gzresolve(). gzdectok() returns GZ_END once only zero padding (or
+  nothing) is left:
+
+  gz_res res;
+
+  gzresinit(&res, out, outsize);
+  while((result = gzdectok(in, insize, &used, buf, 4096,
+                           enqueue, queue)) == GZ_OK)
+  {
+      (on the other thread: gzresolve(&res, batch, count) per batch,
+       then once the member's batches are done:)
+      result = gzresend(&res, in, used);
+      in += used;
+      insize -= used;
+  }
+
+  gzdecpipe() is a ready-made pairing on the caller's gz_runfn. It hands
+  batches over in lockstep: each call of run(user, task, arg, 2) has one
+  task Huffman-decode the next batch into one half of buf (2*bufmax
+  tokens) while the other resolves the previous batch from the other
+  half, and run returning is the only synchronization needed. It
+  decodes all members and checks every trailer; *outlen receives the
+  size of the output. A run of 0 does the two tasks in turn.
+*/
+
+/* Huffman-decode tokens of the current block into tok, stopping at the
+   end of the block (GZ_END, the end-of-block code consumed), before a
+   token that would start at bit stop or later, or once max tokens are
+   out (GZ_OK either way). With pos, the bit offset each token starts at
+   is recorded too. */
+static int
+gz_tokrun(
+    gz_bstream *ins, gz_trees *t, unsigned int stop,
+    unsigned int *tok, unsigned int *pos,
+    unsigned int max, unsigned int *count)
+{
+#define LLLEN GZ_LL_MAX
+
+    unsigned int n, p;
+    int sym, dist, len;
+
+    n = 0;
+    *count = 0;
+    while(n < max)
+    {
+        p = gz_bitpos(ins);
+        if(p >= stop)
+        {
+            break;
+        }
+
+        sym = gz_huffsym(ins, t->llfast, t->ll);
+        if(sym == 256)
+        {
+            *count = n;
+            return(ins->overrun ? GZ_INVFILE : GZ_END);
+        }
+
+        if(sym >= 0 && sym <= 255)
+        {
+            tok[n] = (unsigned int)sym;
+        }
+        else if(sym > 256 && sym < LLLEN)
+        {
+            len = gz_getlen(sym, ins);
+            dist = gz_huffsym(ins, t->distfast, t->dist);
+            dist = gz_getdist(dist, ins);
+
+            if(dist < 0 || len <= 0)
+            {
+                *count = n;
+                return(GZ_INVFILE);
+            }
+
+            tok[n] = GZ_TOK_MATCH | ((unsigned int)len << 16) |
+                     (unsigned int)dist;
+        }
+        else
+        {
+            *count = n;
+            return(GZ_INVFILE);
+        }
+
+        if(ins->overrun)
+        {
+            *count = n;
+            return(GZ_INVFILE);
+        }
+
+        if(pos)
+        {
+            pos[n] = p;
+        }
+        ++n;
+    }
+
+    *count = n;
+    return(GZ_OK);
+
+#undef LLLEN
+}
+
+/* Hand the whole batch buffer to tokfn once it is full */
+#define GZ_TOKFLUSH()\
+    if(n == bufmax)\
+    {\
+        if(tokfn(user, buf, n))\
+        {\
+            return(GZ_ABORTED);\
+        }\
+        n = 0;\
+    }
+
+/* Where the Huffman stage stands in a deflate stream, so that it can
+   stop after any batch and go on later */
+typedef struct
+gz_tokstate
+{
+    gz_bstream ins;
+    gz_trees trees;
+    unsigned int btype;
+    unsigned int islast;
+    /* bytes left of the current stored block */
+    unsigned int stored;
+    int inblock;
+    int done;
+} gz_tokstate;
+
+/* Start on the gzip member at in; GZ_END if only zero padding is
+   left */
+static int
+gz_tokmember(unsigned char *in, unsigned int insize, gz_tokstate *st)
+{
+    unsigned int hlen;
+    int result;
+
+    if(!in)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(gz_iszero(in, insize))
+    {
+        return(GZ_END);
+    }
+
+    result = gz_gzhead(in, insize, &hlen);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    gz_bsinit(&st->ins, in + hlen, insize - hlen);
+    st->islast = 0;
+    st->inblock = 0;
+    st->done = 0;
+    return(GZ_OK);
+}
+
+/* Size of the member at in that st has finished, trailer included */
+static int
+gz_tokused(
+    unsigned char *in, unsigned int insize,
+    gz_tokstate *st, unsigned int *used)
+{
+    unsigned char *p;
+
+    p = gz_bspos(&st->ins);
+    if(in + insize - p < 8)
+    {
+        return(GZ_INVFILE);
+    }
+
+    *used = (unsigned int)(p + 8 - in);
+    return(GZ_OK);
+}
+
+/* Huffman-decode the next tokens of the stream, up to max of them;
+   *count is 0 only once the last block has ended (st->done) */
+static int
+gz_tokstep(
+    gz_tokstate *st, unsigned int *buf, unsigned int max,
+    unsigned int *count)
+{
+    gz_bstream *ins;
+    unsigned int n, k;
+    int len, result;
+
+    ins = &st->ins;
+    n = 0;
+    result = GZ_OK;
+    while(n < max && !st->done)
+    {
+        if(!st->inblock && st->islast)
+        {
+            st->done = 1;
+        }
+        else if(!st->inblock)
+        {
+            st->islast = gz_readbits(ins, 1);
+            st->btype = gz_readbits(ins, 2);
+            buf[n++] = GZ_TOK_BLOCK | (st->btype << 1) | st->islast;
+
+            if(st->btype == 0)
+            {
+                len = gz_storedlen(ins);
+                if(len < 0)
+                {
+                    result = GZ_INVFILE;
+                    break;
+                }
+                st->stored = (unsigned int)len;
+            }
+            else if(st->btype == 3 ||
+                    !gz_blocktrees(ins, st->btype, &st->trees))
+            {
+                result = GZ_INVFILE;
+                break;
+            }
+            st->inblock = 1;
+        }
+        else if(st->btype == 0)
+        {
+            while(n < max && st->stored > 0)
+            {
+                buf[n++] = gz_readbits(ins, 8);
+                --st->stored;
+            }
+            st->inblock = (st->stored > 0);
+        }
+        else
+        {
+            result = gz_tokrun(
+                ins, &st->trees, 0xffffffffU, buf + n, 0, max - n, &k);
+            n += k;
+            if(result == GZ_END)
+            {
+                st->inblock = 0;
+                result = GZ_OK;
+            }
+            else if(result != GZ_OK)
+            {
+                break;
+            }
+        }
+
+        if(ins->overrun)
+        {
+            result = GZ_INVFILE;
+            break;
+        }
+    }
+
+    *count = n;
+    return(result);
+}
+
+/* Huffman stage over the rest of the stream, in batches for tokfn */
+static int
+gz_tokenize(
+    gz_tokstate *st, unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user)
+{
+    unsigned int n;
+    int result;
+
+    if(!buf || bufmax == 0)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    do
+    {
+        result = gz_tokstep(st, buf, bufmax, &n);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+
+        if(n > 0 && tokfn(user, buf, n))
+        {
+            return(GZ_ABORTED);
+        }
+    } while(n > 0);
+
+    return(GZ_OK);
+}
+
+int
+gzdectok(
+    void *in, unsigned int insize, unsigned int *used,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user)
+{
+    gz_tokstate st;
+    int result;
+
+    result = gz_tokmember((unsigned char *)in, insize, &st);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    result = gz_tokenize(&st, buf, bufmax, tokfn, user);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    return(gz_tokused((unsigned char *)in, insize, &st, used));
+}
+
+/**
+  Experimental: gzdectok() with single blocks split across threads.
+  After a block's trees are read, the bits that follow are cut into
+  nparts spans, and each span is Huffman-decoded on its own from a
+  guessed start (the first from the real one), recording where each of
+  its tokens begins. A decode started at a wrong bit offset falls into
+  step with the true symbol boundaries after a few symbols (Huffman
+  codes self-synchronize), so the parts are merged by continuing the
+  exact decode from the end of one part until it lands on a token start
+  recorded by the next, and taking that part's tokens from there on.
+  Tokens need no window, so matches reaching back before a part are not
+  a problem; gzresolve() sees them in order. A part that never lines up
+  is simply decoded again by the merge, so the output is always exact.
+
+  Parts are run through par->run, which the caller implements on its own
+  threads (or sequentially). If the block ends early, the work on later
+  parts is lost, so par->minbits should be a few hundred kilobits.
+*/
+
+typedef struct
+gz_specpart
+{
+    gz_bstream ins;
+    gz_trees *trees;
+    unsigned int begin;
+    unsigned int stop;
+    unsigned int endpos;
+    unsigned int *tok;
+    unsigned int *pos;
+    unsigned int max;
+    unsigned int n;
+    int result;
+} gz_specpart;
+
+static void
+gz_spectask(void *arg, unsigned int index)
+{
+    gz_specpart *part;
+
+    part = (gz_specpart *)arg + index;
+    gz_bsseek(&part->ins, part->begin);
+    part->result = gz_tokrun(
+        &part->ins, part->trees, part->stop,
+        part->tok, part->pos, part->max, &part->n);
+    part->endpos = gz_bitpos(&part->ins);
+}
+
+/* Speculative decode of the rest of a block; *done is set once its end
+   has been passed */
+static int
+gz_specblock(
+    gz_bstream *ins, gz_trees *trees, gz_par *par,
+    unsigned int *buf, unsigned int bufmax, unsigned int *count,
+    gz_tokfn tokfn, void *user)
+{
+    gz_specpart parts[GZ_PAR_MAX];
+    gz_specpart *part;
+    unsigned int start, span, per, nparts, n, k, j, i, p, got;
+    int result;
+
+    n = *count;
+    nparts = (par->nparts < GZ_PAR_MAX) ? par->nparts : GZ_PAR_MAX;
+    per = par->worksize / nparts / 2;
+    start = gz_bitpos(ins);
+    span = (unsigned int)(ins->srcend - ins->src) * 8 - start;
+
+    for(k = 0;
+        k < nparts;
+        ++k)
+    {
+        part = &parts[k];
+        part->ins = *ins;
+        part->trees = trees;
+        part->begin = start + (unsigned int)((double)span * k / nparts);
+        part->stop = (k + 1 < nparts) ?
+            start + (unsigned int)((double)span * (k + 1) / nparts) :
+            0xffffffffU;
+        part->tok = par->work + 2*k*per;
+        part->pos = part->tok + per;
+        part->max = per;
+        part->n = 0;
+    }
+
+    par->run(par->user, gz_spectask, parts, nparts);
+
+    result = GZ_OK;
+    for(k = 0;
+        k < nparts && result == GZ_OK;
+        ++k)
+    {
+        part = &parts[k];
+
+        /* Step the exact decode until it lands on a token start of this
+           part; the first part starts in step */
+        j = 0;
+        for(;;)
+        {
+            p = gz_bitpos(ins);
+            while(j < part->n && part->pos[j] < p)
+            {
+                ++j;
+            }
+
+            if((j < part->n && part->pos[j] == p) ||
+               (k == 0 && part->begin == p))
+            {
+                break;
+            }
+
+            if(j >= part->n || p >= part->stop)
+            {
+                j = part->n;
+                break;
+            }
+
+            GZ_TOKFLUSH();
+            result = gz_tokrun(ins, trees, 0xffffffffU, buf + n, 0, 1, &got);
+            n += got;
+            if(result != GZ_OK)
+            {
+                break;
+            }
+        }
+
+        if(result != GZ_OK)
+        {
+            break;
+        }
+
+        /* In step: take the rest of the part as it is */
+        if(j < part->n || (k == 0 && part->n == 0))
+        {
+            for(i = j;
+                i < part->n;
+                ++i)
+            {
+                GZ_TOKFLUSH();
+                buf[n++] = part->tok[i];
+            }
+
+            gz_bsseek(ins, part->endpos);
+            if(part->result != GZ_OK)
+            {
+                result = part->result;
+                break;
+            }
+        }
+
+        /* Finish the span exactly if the part stopped short of it */
+        do
+        {
+            GZ_TOKFLUSH();
+            result = gz_tokrun(
+                ins, trees, part->stop, buf + n, 0, bufmax - n, &got);
+            n += got;
+        } while(result == GZ_OK && got > 0);
+    }
+
+    *count = n;
+    return(result);
+}
+
+int
+gzdectokpar(
+    void *in, unsigned int insize, unsigned int *used,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user, gz_par *par)
+{
+    gz_tokstate st;
+    gz_bstream *ins;
+    gz_trees *trees;
+    unsigned int islast, btype, n, k;
+    int len, result;
+
+    result = gz_tokmember((unsigned char *)in, insize, &st);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    ins = &st.ins;
+    trees = &st.trees;
+
+    /* Bit offsets are kept in an unsigned int */
+    if(!buf || bufmax == 0 ||
+       !par || !par->run || par->nparts < 2 || !par->work ||
+       par->worksize / par->nparts / 2 == 0 || insize > 0x1fffffffU)
+    {
+        result = gz_tokenize(&st, buf, bufmax, tokfn, user);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+
+        return(gz_tokused((unsigned char *)in, insize, &st, used));
+    }
+
+    n = 0;
+    islast = 0;
+    while(!islast)
+    {
+        islast = gz_readbits(ins, 1);
+        btype = gz_readbits(ins, 2);
+        GZ_TOKFLUSH();
+        buf[n++] = GZ_TOK_BLOCK | (btype << 1) | islast;
+
+        if(btype == 0)
+        {
+            len = gz_storedlen(ins);
+            if(len < 0)
+            {
+                return(GZ_INVFILE);
+            }
+
+            while(len > 0)
+            {
+                GZ_TOKFLUSH();
+                buf[n++] = gz_readbits(ins, 8);
+                --len;
+            }
+        }
+        else if(btype == 1 || btype == 2)
+        {
+            if(!gz_blocktrees(ins, btype, trees))
+            {
+                return(GZ_INVFILE);
+            }
+
+            result = GZ_OK;
+            if((unsigned int)(ins->srcend - ins->src) * 8 -
+               gz_bitpos(ins) >= par->minbits)
+            {
+                result = gz_specblock(
+                    ins, trees, par, buf, bufmax, &n, tokfn, user);
+            }
+
+            while(result == GZ_OK)
+            {
+                GZ_TOKFLUSH();
+                result = gz_tokrun(
+                    ins, trees, 0xffffffffU, buf + n, 0, bufmax - n, &k);
+                n += k;
+            }
+
+            if(result != GZ_END)
+            {
+                return(result);
+            }
+        }
+        else
+        {
+            return(GZ_INVFILE);
+        }
+
+        if(ins->overrun)
+        {
+            return(GZ_INVFILE);
+        }
+    }
+
+    if(n > 0 && tokfn(user, buf, n))
+    {
+        return(GZ_ABORTED);
+    }
+
+    return(gz_tokused((unsigned char *)in, insize, &st, used));
+}
+
+void
+gzresinit(gz_res *res, void *out, unsigned int outsize)
+{
+    res->out = (unsigned char *)out;
+    res->outsize = outsize;
+    res->outlen = 0;
+    res->crc = 0;
+    res->mstart = 0;
+}
+
+int
+gzresolve(gz_res *res, unsigned int *tok, unsigned int count)
+{
+    unsigned char *outp, *outend, *backp, *start;
+    unsigned int t, len, dist;
+
+    start = res->out + res->outlen;
+    outp = start;
+    outend = res->out + res->outsize;
+
+    while(count > 0)
+    {
+        t = *tok++;
+        --count;
+
+        if(!(t & (GZ_TOK_MATCH | GZ_TOK_BLOCK)))
+        {
+            if(outp >= outend)
+            {
+                return(GZ_NOSPACE);
+            }
+            *outp++ = (unsigned char)t;
+        }
+        else if(t & GZ_TOK_MATCH)
+        {
+            len = (t >> 16) & 0x1ff;
+            dist = t & 0xffff;
+            /* Only the current member can be referred to */
+            if(dist == 0 ||
+               dist > (unsigned int)(outp - (res->out + res->mstart)))
+            {
+                return(GZ_INVFILE);
+            }
+            if(len > (unsigned int)(outend - outp))
+            {
+                return(GZ_NOSPACE);
+            }
+
+            backp = outp - dist;
+            while(len > 0)
+            {
+                *outp++ = *backp++;
+                --len;
+            }
+        }
+    }
+
+    res->crc = gzcrc32(res->crc, start, (unsigned int)(outp - start));
+    res->outlen = (unsigned int)(outp - res->out);
+
+    return(GZ_OK);
+}
+
+int
+gzresend(gz_res *res, void *in, unsigned int used)
+{
+    unsigned char *p;
+
+    if(!in || used < 18)
+    {
+        return(GZ_INVFILE);
+    }
+
+    p = (unsigned char *)in + used - 8;
+    if(res->crc != gz_read32le(p))
+    {
+        return(GZ_INVCRC);
+    }
+
+    if(res->outlen - res->mstart != gz_read32le(p + 4))
+    {
+        return(GZ_INVFILE);
+    }
+
+    res->crc = 0;
+    res->mstart = res->outlen;
+    return(GZ_OK);
+}
+
+/* The two stages of gzdecpipe(), each working on its own half of the
+   batch buffer */
+typedef struct
+gz_pipe
+{
+    gz_tokstate tok;
+    gz_res res;
+    unsigned int *buf[2];
+    unsigned int count[2];
+    unsigned int bufmax;
+    /* half the Huffman stage fills, the other is being resolved */
+    unsigned int fill;
+    int tokresult;
+    int resresult;
+} gz_pipe;
+
+static void
+gz_pipetask(void *arg, unsigned int index)
+{
+    gz_pipe *pl;
+
+    pl = (gz_pipe *)arg;
+    if(index == 0)
+    {
+        pl->tokresult = gz_tokstep(
+            &pl->tok, pl->buf[pl->fill], pl->bufmax, &pl->count[pl->fill]);
+    }
+    else
+    {
+        pl->resresult = gzresolve(
+            &pl->res, pl->buf[!pl->fill], pl->count[!pl->fill]);
+    }
+}
+
+int
+gzdecpipe(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, unsigned int *outlen,
+    unsigned int *buf, unsigned int bufmax,
+    gz_runfn run, void *user)
+{
+    gz_pipe pl;
+    unsigned char *p;
+    unsigned int left, used;
+    int result;
+
+    *outlen = 0;
+    if(!in || !out || !buf || bufmax == 0)
+    {
+        return(GZ_INVFILE);
+    }
+
+    gzresinit(&pl.res, out, outsize);
+    pl.buf[0] = buf;
+    pl.buf[1] = buf + bufmax;
+    pl.bufmax = bufmax;
+
+    p = (unsigned char *)in;
+    left = insize;
+    for(;;)
+    {
+        result = gz_tokmember(p, left, &pl.tok);
+        if(result != GZ_OK)
+        {
+            break;
+        }
+
+        /* Until the Huffman stage has nothing more for the resolver */
+        pl.fill = 0;
+        pl.count[1] = 0;
+        do
+        {
+            if(run)
+            {
+                run(user, gz_pipetask, &pl, 2);
+            }
+            else
+            {
+                gz_pipetask(&pl, 0);
+                gz_pipetask(&pl, 1);
+            }
+
+            result = (pl.tokresult != GZ_OK) ? pl.tokresult : pl.resresult;
+            pl.fill = !pl.fill;
+        } while(result == GZ_OK && pl.count[!pl.fill] > 0);
+
+        if(result == GZ_OK)
+        {
+            result = gz_tokused(p, left, &pl.tok, &used);
+        }
+
+        if(result == GZ_OK)
+        {
+            result = gzresend(&pl.res, p, used);
+        }
+
+        if(result != GZ_OK)
+        {
+            break;
+        }
+
+        p += used;
+        left -= used;
+    }
+
+    /* At least one member, then only padding */
+    if(result == GZ_END)
+    {
+        result = (p == (unsigned char *)in) ? GZ_INVFILE : GZ_OK;
+    }
+
+    *outlen = pl.res.outlen;
+    return(result);
+}
+
+/**
+  Compact serialization of the token stream, so a transcoder can skip
+  match finding and go straight to entropy coding:
+
+  0lllllll            literal run of l + 1 bytes, which follow
+  10000000 L D0 D1    match of length L + 3, distance (D0 | D1 << 8) + 1
+  110000bi            start of a deflate block of type b0 (bits 1-2
+                      hold btype), islast in bit 0
+
+  gztokenc() is a gz_tokfn that writes this form to a sink, instead of
+  or (called next to gzresolve() from the caller's own tokfn) alongside
+  the output. gztokdec() reads it back into token batches:
+
+  gz_tokenc enc;
+
+  gztokencinit(&enc, write_out, file);
+  result = gzdectok(in, insize, &used, buf, 4096, gztokenc, &enc);
+  if(result == GZ_OK)
+  {
+      result = gztokencend(&enc);
+  }
+*/
+
+void
+gztokencinit(gz_tokenc *enc, gz_sinkfn sink, void *user)
+{
+    enc->sink = sink;
+    enc->user = user;
+    enc->nlit = 0;
+    enc->n = 0;
+}
+
+static int
+gz_tokput(gz_tokenc *enc, unsigned char *data, unsigned int size)
+{
+    if(enc->n + size > sizeof(enc->buf))
+    {
+        if(enc->sink(enc->user, enc->buf, enc->n))
+        {
+            return(1);
+        }
+        enc->n = 0;
+    }
+
+    while(size > 0)
+    {
+        enc->buf[enc->n++] = *data++;
+        --size;
+    }
+
+    return(0);
+}
+
+static int
+gz_toklits(gz_tokenc *enc)
+{
+    unsigned char tag;
+
+    if(enc->nlit == 0)
+    {
+        return(0);
+    }
+
+    tag = (unsigned char)(enc->nlit - 1);
+    if(gz_tokput(enc, &tag, 1) || gz_tokput(enc, enc->lit, enc->nlit))
+    {
+        return(1);
+    }
+    enc->nlit = 0;
+
+    return(0);
+}
+
+int
+gztokenc(void *user, unsigned int *tok, unsigned int count)
+{
+    gz_tokenc *enc;
+    unsigned char rec[4];
+    unsigned int t;
+
+    enc = (gz_tokenc *)user;
+    while(count > 0)
+    {
+        t = *tok++;
+        --count;
+
+        if(!(t & (GZ_TOK_MATCH | GZ_TOK_BLOCK)))
+        {
+            enc->lit[enc->nlit++] = (unsigned char)t;
+            if(enc->nlit == sizeof(enc->lit) && gz_toklits(enc))
+            {
+                return(1);
+            }
+            continue;
+        }
+
+        if(gz_toklits(enc))
+        {
+            return(1);
+        }
+
+        if(t & GZ_TOK_MATCH)
+        {
+            rec[0] = 0x80;
+            rec[1] = (unsigned char)(((t >> 16) & 0x1ff) - 3);
+            rec[2] = (unsigned char)((t & 0xffff) - 1);
+            rec[3] = (unsigned char)(((t & 0xffff) - 1) >> 8);
+            if(gz_tokput(enc, rec, 4))
+            {
+                return(1);
+            }
+        }
+        else
+        {
+            rec[0] = (unsigned char)(0xc0 | (t & 0x07));
+            if(gz_tokput(enc, rec, 1))
+            {
+                return(1);
+            }
+        }
+    }
+
+    return(0);
+}
+
+int
+gztokencend(gz_tokenc *enc)
+{
+    if(gz_toklits(enc))
+    {
+        return(GZ_ABORTED);
+    }
+
+    if(enc->n > 0 && enc->sink(enc->user, enc->buf, enc->n))
+    {
+        return(GZ_ABORTED);
+    }
+    enc->n = 0;
+
+    return(GZ_OK);
+}
+
+int
+gztokdec(
+    void *data, unsigned int size,
+    unsigned int *buf, unsigned int bufmax,
+    gz_tokfn tokfn, void *user)
+{
+#define PUT(t)\
+    if(n == bufmax)\
+    {\
+        if(tokfn(user, buf, n))\
+        {\
+            return(GZ_ABORTED);\
+        }\
+        n = 0;\
+    }\
+    buf[n++] = (t);
+
+    unsigned char *p, *end;
+    unsigned int n, run;
+
+    if(!buf || bufmax == 0)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    p = (unsigned char *)data;
+    end = p + size;
+    n = 0;
+    while(p < end)
+    {
+        if(!(*p & 0x80))
+        {
+            run = (unsigned int)*p++ + 1;
+            if(run > (unsigned int)(end - p))
+            {
+                return(GZ_INVFILE);
+            }
+            while(run > 0)
+            {
+                PUT(*p++);
+                --run;
+            }
+        }
+        else if(*p == 0x80)
+        {
+            if(end - p < 4)
+            {
+                return(GZ_INVFILE);
+            }
+            PUT(GZ_TOK_MATCH | (((unsigned int)p[1] + 3) << 16) |
+                (((unsigned int)p[2] | ((unsigned int)p[3] << 8)) + 1));
+            p += 4;
+        }
+        else if((*p & 0xf8) == 0xc0)
+        {
+            PUT(GZ_TOK_BLOCK | (*p & 0x07));
+            ++p;
+        }
+        else
+        {
+            return(GZ_INVFILE);
+        }
+    }
+
+    if(n > 0 && tokfn(user, buf, n))
+    {
+        return(GZ_ABORTED);
+    }
+
+    return(GZ_OK);
+
+#undef PUT
+}
+
+/* Size of the BGZF block starting at in, taken from the BC subfield of
+   its gzip extra field; 0 if in is not a BGZF block */
+static unsigned int
+gz_bgzfbsize(unsigned char *in, unsigned int insize)
+{
+    unsigned int xlen, pos, slen;
+
+    if(insize < 18 || in[0] != 0x1f || in[1] != 0x8b || in[2] != 8 ||
+       !(in[3] & 0x04))
+    {
+        return(0);
+    }
+
+    xlen = (unsigned int)in[10] | ((unsigned int)in[11] << 8);
+    if(12 + xlen > insize)
+    {
+        return(0);
+    }
+
+    pos = 12;
+    while(pos + 4 <= 12 + xlen)
+    {
+        slen = (unsigned int)in[pos + 2] | ((unsigned int)in[pos + 3] << 8);
+        if(in[pos] == 'B' && in[pos + 1] == 'C' && slen == 2 &&
+           pos + 6 <= 12 + xlen)
+        {
+            return(((unsigned int)in[pos + 4] |
+                    ((unsigned int)in[pos + 5] << 8)) + 1);
+        }
+        pos += 4 + slen;
+    }
+
+    return(0);
+}
+
+int
+gzformat(void *in, unsigned int insize)
+{
+    unsigned char *p;
+
+    p = (unsigned char *)in;
+    if(!p)
+    {
+        return(GZ_FMT_UNKNOWN);
+    }
+
+    if(insize >= 18 && p[0] == 0x1f && p[1] == 0x8b)
+    {
+        return(gz_bgzfbsize(p, insize) ? GZ_FMT_BGZF : GZ_FMT_GZIP);
+    }
+
+    if(insize >= 6 && (p[0] & 0x0f) == 8 && (p[0] >> 4) <= 7 &&
+       (((unsigned int)p[0] << 8) | p[1]) % 31 == 0 && !(p[1] & 0x20))
+    {
+        return(GZ_FMT_ZLIB);
+    }
+
+    return(GZ_FMT_UNKNOWN);
+}
+
+/**
+  Decompress whatever in holds: gzip (including concatenated members
+  and BGZF), zlib or raw deflate. Anything else is passed through as is.
+  *outlen receives the number of bytes produced.
+
+  gzip and zlib are recognized by their headers. Other input is first
+  decoded as raw deflate, which must use up the input exactly; if that
+  fails, or its output would not fit in out while the input would, it is
+  taken to be uncompressed. The same goes for zlib, as two bytes of
+  text such as "x^" or "HK" make a valid zlib header: its errors are
+  only reported when the input does not fit out as it is. In both cases
+  the sink only sees the output once it is known to be good. Passing
+  through is a plain copy into out, not zero-copy: callers that can use
+  the input in place should check gzformat() and try raw deflate
+  themselves to avoid it.
+*/
+int
+gzdecany(
+    void *in, unsigned int insize,
+    void *out, unsigned int outsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user)
+{
+    gz_out o;
+    gz_bstream ins;
+    unsigned char *p;
+    unsigned int left, used;
+    int format, result;
+
+    *outlen = 0;
+    if(!in || !out)
+    {
+        return(GZ_INVFILE);
+    }
+
+    format = gzformat(in, insize);
+    gz_outinit(&o, out, outsize, sink, user, 0);
+    result = GZ_OK;
+
+    if(format == GZ_FMT_GZIP || format == GZ_FMT_BGZF)
+    {
+        p = (unsigned char *)in;
+        left = insize;
+
+        /* Stop at trailing zero padding, as gzip(1) does */
+        while(left > 0 && !gz_iszero(p, left))
+        {
+            result = gz_member(p, left, &o, &used);
+            if(result != GZ_OK)
+            {
+                break;
+            }
+            p += used;
+            left -= used;
+        }
+    }
+    else
+    {
+        /* The sink only sees zlib or raw deflate output once it is known
+           to be valid */
+        o.sink = 0;
+        if(format == GZ_FMT_ZLIB)
+        {
+            result = gz_zlib((unsigned char *)in, insize, &o);
+        }
+        else
+        {
+            o.check = GZ_CHECK_NONE;
+            gz_bsinit(&ins, (unsigned char *)in, insize);
+            result = gz_inflate(&ins, &o, 0);
+            if(result == GZ_OK && gz_bspos(&ins) != ins.srcend)
+            {
+                result = GZ_INVFILE;
+            }
+        }
+
+        /* A prefix of plain data can happen to be deflate that expands
+           past out */
+        if(result == GZ_INVFILE || result == GZ_INVCRC ||
+           result == GZ_INVCMETHOD ||
+           (result == GZ_NOSPACE && insize <= outsize))
+        {
+            if(insize > outsize)
+            {
+                return((format == GZ_FMT_ZLIB) ? result : GZ_NOSPACE);
+            }
+
+            p = (unsigned char *)in;
+            for(used = 0;
+                used < insize;
+                ++used)
+            {
+                o.start[used] = p[used];
+            }
+            o.ptr = o.start + insize;
+            result = GZ_OK;
+        }
+
+        if(result == GZ_OK)
+        {
+            o.sink = sink;
+            o.flushp = o.start;
+            while(o.flushp < o.ptr)
+            {
+                used = (unsigned int)(o.ptr - o.flushp);
+                if(used > GZ_CHUNK)
+                {
+                    used = GZ_CHUNK;
+                }
+                if(sink && sink(user, o.flushp, used))
+                {
+                    return(GZ_ABORTED);
+                }
+                o.flushp += used;
+            }
+        }
+    }
+
+    if(result == GZ_OK)
+    {
+        *outlen = (unsigned int)(o.ptr - (unsigned char *)out);
+    }
+
+    return(result);
+}
+
+/**
+  Decompress gzip (including BGZF) or zlib of any decoded size through a
+  window buffer instead of a buffer for the whole output. Output is
+  handed to the sink in chunks of about GZ_CHUNK bytes, which must be
+  used before the sink returns: the window is reused. Once the window
+  fills up, the last GZ_WINDOW bytes are moved to its front, so the
+  history stays contiguous and back-references are copied just as in
+  gzdec(), with no wrap-around. The window must be at least
+  2 * GZ_WINDOW; a larger one moves its history less often, and at
+  4 * GZ_WINDOW the moving costs about a third of a copy per byte of
+  output.
+*/
+/* Decode gzip members up to the end of in or trailing zero padding */
+static int
+gz_members(unsigned char *in, unsigned int insize, gz_out *o)
+{
+    unsigned int used;
+    int result;
+
+    while(insize > 0 && !gz_iszero(in, insize))
+    {
+        result = gz_member(in, insize, o, &used);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+        in += used;
+        insize -= used;
+    }
+
+    return(GZ_OK);
+}
+
+static int
+gz_decwindow(void *in, unsigned int insize, gz_out *o)
+{
+    int format, result;
+
+    format = gzformat(in, insize);
+
+    if(format == GZ_FMT_GZIP || format == GZ_FMT_BGZF)
+    {
+        result = gz_members((unsigned char *)in, insize, o);
+    }
+    else if(format == GZ_FMT_ZLIB)
+    {
+        result = gz_zlib((unsigned char *)in, insize, o);
+    }
+    else
+    {
+        result = GZ_INVMAGIC;
+    }
+
+    return(result);
+}
+
+int
+gzdecstream(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user)
+{
+    return(gzdecindex(in, insize, window, windowsize, outlen,
+                      sink, user, 0));
+}
+
+/**
+  gzdecstream() that also records a checkpoint index of in for
+  gzdecrange(), with a point about every idx->spacing bytes of output.
+  Points are taken at deflate block ends and gzip headers, with the
+  history already in the window, so each costs a copy of at most
+  GZ_WINDOW bytes. When idx fills up, every other point is dropped and
+  the spacing doubled, so the index always covers all of in. Save it
+  with gzindexwrite() once decoding succeeds, and later random access
+  needs no indexing pass. With a window at least 258 bytes larger than
+  the output, nothing is moved and all of it stays in the window, as
+  with gzdecany(). gzstreamdec() records points as well when the
+  stream's idx is set, and gzdecbufindex(), gzdecdirectindex() and
+  gzdecsparseindex() are gzdec(), gzdecdirect() and gzdecsparse() that
+  record into idx. Points keep 32-bit offsets, so past 512 MiB of input
+  or 4 GiB of output no more are recorded and idx->truncated is set;
+  the decode itself goes on, and the points so far still work.
+*/
+int
+gzdecindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int *outlen,
+    gz_sinkfn sink, void *user, gz_index *idx)
+{
+    gz_out o;
+    int result;
+
+    *outlen = 0;
+    if(!in || !window)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(windowsize < 2*GZ_WINDOW)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    gz_outinit(&o, window, windowsize, sink, user, 0);
+    o.window = 1;
+    gz_indexstart(&o, idx, in);
+
+    result = gz_decwindow(in, insize, &o);
+    if(result == GZ_OK)
+    {
+        *outlen = gz_outpos(&o);
+        if(idx)
+        {
+            idx->size = gz_outposhi(&o) ? 0 : *outlen;
+            idx->insize = insize;
+            idx->truncated |= (gz_outposhi(&o) != 0);
+        }
+    }
+
+    return(result);
+}
+
+/**
+  gzdecstream() for zero-copy output, e.g. with vmsplice() to a pipe or
+  send() with MSG_ZEROCOPY to a socket. The window must be aligned to
+  page bytes (a power of two, normally the system page size) and at
+  least 2 * GZ_WINDOW + page long. The sink is handed whole, aligned
+  pages in place, except for the last chunk, and may keep referring to
+  them after it returns. Before any of those bytes are overwritten,
+  release is called and must wait until they are no longer read: for
+  MSG_ZEROCOPY, until the completions for everything sent so far have
+  arrived. Release is needed only once per pass through the window, so
+  a larger window waits less often.
+
+  For a pipe whose reader copies the data out, any byte handed out has
+  been read once pipe capacity more bytes have been handed out after it.
+  A window of at least 2 * (GZ_WINDOW + page) plus the pipe capacity
+  keeps overwritten bytes that far behind, and release can do nothing.
+*/
+int
+gzdecpages(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize, unsigned int page,
+    unsigned int *outlen,
+    gz_sinkfn sink, gz_releasefn release, void *user)
+{
+    gz_out o;
+    int result;
+
+    *outlen = 0;
+    if(!in || !window || page == 0 || (page & (page - 1)))
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(page > windowsize || windowsize - page < 2*GZ_WINDOW)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    gz_outinit(&o, window, windowsize, sink, user, 0);
+    o.window = 1;
+    o.align = page;
+    o.release = release;
+    result = gz_decwindow(in, insize, &o);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    if(o.ptr > o.sinkp && sink &&
+       sink(user, o.sinkp, (unsigned int)(o.ptr - o.sinkp)))
+    {
+        return(GZ_ABORTED);
+    }
+
+    *outlen = gz_outpos(&o);
+    return(GZ_OK);
+}
+
+/**
+  Decompress to a file opened with O_DIRECT, so a large restore does
+  not push other data out of the page cache. write is called with
+  buffers, offsets and sizes that are all multiples of block, out of
+  the window (aligned to block, at least 2 * GZ_WINDOW + block long);
+  the last write is zero-padded up to a multiple of sector, so the file
+  has to be truncated to its size, *outhi * 2^32 + *outlen, afterwards.
+  Offsets are 64-bit in the same way, so output may exceed 4 GiB. block
+  and sector are powers of two, sector (the device's logical block
+  size) at most block; block around 1 MB keeps the device busy with few
+  calls. The input is in memory, so reading it with O_DIRECT is up to
+  the caller.
+
+  write must be done with the data when it returns; for asynchronous
+  writes, use gzdecpages() with block as the page size and wait for the
+  writes in release.
+*/
+
+typedef struct
+gz_direct
+{
+    gz_writefn write;
+    void *user;
+    unsigned int offset;
+    unsigned int offsethi;
+    unsigned int block;
+    int sparse;
+} gz_direct;
+
+/* Write size bytes at the current offset; when sparse, runs of all-zero
+   blocks go out as one write without data */
+static int
+gz_directput(gz_direct *d, unsigned char *p, unsigned int size)
+{
+    unsigned int n, run;
+    int zero, z;
+
+    while(size > 0)
+    {
+        zero = -1;
+        run = 0;
+        while(run < size)
+        {
+            n = (size - run < d->block) ? size - run : d->block;
+            z = d->sparse && gz_iszero(p + run, n);
+            if(zero >= 0 && z != zero)
+            {
+                break;
+            }
+            zero = z;
+            run += n;
+        }
+
+        if(d->write(d->user, zero ? 0 : p, run, d->offset, d->offsethi))
+        {
+            return(1);
+        }
+
+        d->offset += run;
+        if(d->offset < run)
+        {
+            ++d->offsethi;
+        }
+        p += run;
+        size -= run;
+    }
+
+    return(0);
+}
+
+static int
+gz_directsink(void *user, void *data, unsigned int size)
+{
+    return(gz_directput((gz_direct *)user, (unsigned char *)data, size));
+}
+
+static int
+gz_decblocks(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector, int sparse,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user, gz_index *idx)
+{
+    gz_out o;
+    gz_direct d;
+    unsigned int size;
+    int result;
+
+    *outlen = 0;
+    *outhi = 0;
+    if(!in || !window || !write ||
+       block == 0 || (block & (block - 1)) ||
+       sector == 0 || (sector & (sector - 1)) || sector > block)
+    {
+        return(GZ_INVFILE);
+    }
+
+    /* A window of whole blocks has room to pad the tail */
+    windowsize &= ~(block - 1);
+    if(windowsize < block || windowsize - block < 2*GZ_WINDOW)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    d.write = write;
+    d.user = user;
+    d.offset = 0;
+    d.offsethi = 0;
+    d.block = block;
+    d.sparse = sparse;
+
+    gz_outinit(&o, window, windowsize, gz_directsink, &d, 0);
+    o.window = 1;
+    o.align = block;
+    gz_indexstart(&o, idx, in);
+    result = gz_decwindow(in, insize, &o);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    size = (unsigned int)(o.ptr - o.sinkp);
+    if(size > 0)
+    {
+        gz_memset(o.ptr, 0, ((size + sector - 1) & ~(sector - 1)) - size);
+        size = (size + sector - 1) & ~(sector - 1);
+        if(gz_directput(&d, o.sinkp, size))
+        {
+            return(GZ_ABORTED);
+        }
+    }
+
+    *outlen = gz_outpos(&o);
+    *outhi = gz_outposhi(&o);
+    if(idx)
+    {
+        idx->size = *outhi ? 0 : *outlen;
+        idx->insize = insize;
+        idx->truncated |= (*outhi != 0);
+    }
+
+    return(GZ_OK);
+}
+
+int
+gzdecdirect(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user)
+{
+    return(gz_decblocks(
+        in, insize, window, windowsize, block, sector, 0,
+        outlen, outhi, write, user, 0));
+}
+
+/* gzdecdirect() that also records a checkpoint index of in, as
+   gzdecindex() does */
+int
+gzdecdirectindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user, gz_index *idx)
+{
+    return(gz_decblocks(
+        in, insize, window, windowsize, block, sector, 0,
+        outlen, outhi, write, user, idx));
+}
+
+/**
+  gzdecdirect() for mostly empty data such as disk images: runs of
+  blocks that decode to all zeros are passed to write with data 0
+  instead of being written. On a new file write can simply skip them
+  (truncating to *outhi * 2^32 + *outlen at the end sets the size),
+  leaving holes; over existing data it should punch a hole, e.g. with
+  fallocate(). Images past 4 GiB are fine, as offsets and the size are
+  64-bit. A smaller block finds more holes. With sector 1 no padding is
+  added, for files not opened with O_DIRECT.
+*/
+int
+gzdecsparse(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user)
+{
+    return(gz_decblocks(
+        in, insize, window, windowsize, block, sector, 1,
+        outlen, outhi, write, user, 0));
+}
+
+/* gzdecsparse() that also records a checkpoint index of in */
+int
+gzdecsparseindex(
+    void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    unsigned int block, unsigned int sector,
+    unsigned int *outlen, unsigned int *outhi,
+    gz_writefn write, void *user, gz_index *idx)
+{
+    return(gz_decblocks(
+        in, insize, window, windowsize, block, sector, 1,
+        outlen, outhi, write, user, idx));
+}
+
+/**
+  Long-lived streams, such as one per connection, where input arrives a
+  piece at a time. gzstreamdec() decodes as much of in as it can and
+  sets *used to the bytes the caller may drop; the rest must be passed
+  again, followed by new input, on the next call. It stops after the
+  last symbol that is all there and hands out the output up to it, so
+  a call does no work again that an earlier one did, apart from reading
+  the code tables of the current block: a block's input is kept until
+  the block is done.
+
+  A stream decodes straight into its window slot from a slab, a
+  GZ_STREAM_SLOT (2 * GZ_WINDOW) one while busy. gzstreamidle() moves
+  an idle stream into the smallest slot its history fits, or frees it
+  between gzip members. Within a member the history is GZ_WINDOW bytes
+  once that much has been decoded, so hibernating saves half the slot
+  there; the big savings come from streams idle between members, and
+  the next gzstreamdec() takes a full slot again.
+
+  gz_slab slab;
+  gz_stream st;
+
+  gzslabinit(&slab, arena, arenasize);
+  gzstreaminit(&st, GZ_FMT_GZIP);
+  (on input)
+  result = gzstreamdec(&st, &slab, buf, buflen, &used, sink, conn);
+  (drop used bytes from buf)
+  (after an idle timeout)
+  gzstreamidle(&st, &slab);
+
+  The format is GZ_FMT_GZIP (members may follow each other), GZ_FMT_ZLIB
+  or GZ_FMT_UNKNOWN for raw deflate. gzstreamdec() returns GZ_END once
+  a zlib or raw deflate stream has ended. Setting st.idx after
+  gzstreaminit() records a checkpoint index on the way, as gzdecindex()
+  does; its offsets count the input from the first call on.
+*/
+
+void
+gzslabinit(gz_slab *slab, void *arena, unsigned int size)
+{
+    unsigned int i;
+
+    slab->arena = (unsigned char *)arena;
+    slab->size = size;
+    slab->top = 0;
+    slab->inuse = 0;
+    for(i = 0;
+        i < GZ_SLAB_CLASSES;
+        ++i)
+    {
+        slab->free[i] = 0;
+    }
+}
+
+static unsigned int
+gz_slabclass(unsigned int size)
+{
+    unsigned int c;
+
+    c = 0;
+    while(c < GZ_SLAB_CLASSES && (1024U << c) < size)
+    {
+        ++c;
+    }
+
+    return(c);
+}
+
+void *
+gzslaballoc(gz_slab *slab, unsigned int size)
+{
+    unsigned char *p;
+    unsigned int c;
+
+    c = gz_slabclass(size);
+    if(size == 0 || c >= GZ_SLAB_CLASSES)
+    {
+        return(0);
+    }
+
+    if(slab->free[c])
+    {
+        p = (unsigned char *)slab->free[c];
+        slab->free[c] = *(void **)p;
+    }
+    else
+    {
+        if(slab->size - slab->top < (1024U << c))
+        {
+            return(0);
+        }
+        p = slab->arena + slab->top;
+        slab->top += 1024U << c;
+    }
+
+    slab->inuse += 1024U << c;
+    return(p);
+}
+
+void
+gzslabfree(gz_slab *slab, void *p, unsigned int size)
+{
+    unsigned int c;
+
+    if(!p)
+    {
+        return;
+    }
+
+    c = gz_slabclass(size);
+    if(c >= GZ_SLAB_CLASSES)
+    {
+        return;
+    }
+
+    *(void **)p = slab->free[c];
+    slab->free[c] = p;
+    slab->inuse -= 1024U << c;
+}
+
+#define GZ_STREAM_HEAD 0
+#define GZ_STREAM_BLOCKS 1
+#define GZ_STREAM_TRAILER 2
+#define GZ_STREAM_DONE 3
+
+void
+gzstreaminit(gz_stream *st, int format)
+{
+    st->format = format;
+    st->state = (format == GZ_FMT_UNKNOWN) ?
+        GZ_STREAM_BLOCKS : GZ_STREAM_HEAD;
+    st->inblock = 0;
+    st->hdrpos = 0;
+    st->pos = 0;
+    st->check = (format == GZ_FMT_ZLIB) ? 1 : 0;
+    st->size = 0;
+    st->win = 0;
+    st->winsize = 0;
+    st->have = 0;
+    st->idx = 0;
+    st->inpos = 0;
+    st->outpos = 0;
+}
+
+int
+gzstreamdec(
+    gz_stream *st, gz_slab *slab,
+    void *in, unsigned int insize, unsigned int *used,
+    gz_sinkfn sink, void *user)
+{
+    gz_out o;
+    gz_bstream ins;
+    gz_resume rs;
+    unsigned char *p, *win;
+    unsigned int hlen, mbase, keep, i;
+    int result;
+
+    *used = 0;
+    if(!in)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(st->state == GZ_STREAM_DONE)
+    {
+        return(GZ_END);
+    }
+
+    /* Bring an idle stream's history back into a full slot */
+    if(st->winsize < GZ_STREAM_SLOT)
+    {
+        win = (unsigned char *)gzslaballoc(slab, GZ_STREAM_SLOT);
+        if(!win)
+        {
+            return(GZ_NOSPACE);
+        }
+        for(i = 0;
+            i < st->have;
+            ++i)
+        {
+            win[i] = st->win[i];
+        }
+        gzslabfree(slab, st->win, st->winsize);
+        st->win = win;
+        st->winsize = GZ_STREAM_SLOT;
+    }
+
+    /* Decode straight into the slot, after the history */
+    gz_outinit(&o, st->win, st->winsize, sink, user, 0);
+    o.window = 1;
+    o.ptr = o.base + st->have;
+    o.flushp = o.ptr;
+    o.slid = st->outpos - st->have;
+
+    o.check = (st->format == GZ_FMT_GZIP) ? GZ_CHECK_CRC :
+              (st->format == GZ_FMT_ZLIB) ? GZ_CHECK_ADLER : GZ_CHECK_NONE;
+    o.crc = st->check;
+    o.adler = st->check;
+    mbase = gz_outpos(&o) - st->size;
+    o.idx = st->idx;
+    o.idxin = (unsigned char *)in;
+    o.idxoff = st->inpos;
+    if(o.idx && o.idx->blooms && st->outpos == 0 && o.idx->npoints == 0)
+    {
+        gz_bloomclear(o.idx, 0);
+    }
+
+    rs.inblock = st->inblock;
+    rs.hdrpos = st->hdrpos;
+    rs.pos = st->pos;
+    gz_bsinit(&ins, (unsigned char *)in, insize);
+
+    result = GZ_OK;
+    while(result == GZ_OK)
+    {
+        p = (unsigned char *)in + rs.pos / 8;
+        if(st->state == GZ_STREAM_HEAD)
+        {
+            if(st->format == GZ_FMT_ZLIB)
+            {
+                if(insize - rs.pos / 8 < 2)
+                {
+                    break;
+                }
+
+                if((p[0] & 0x0f) != 8 || (p[0] >> 4) > 7 ||
+                   (((unsigned int)p[0] << 8) | p[1]) % 31 != 0 ||
+                   (p[1] & 0x20))
+                {
+                    return(GZ_INVMAGIC);
+                }
+                hlen = 2;
+                o.adler = 1;
+            }
+            else
+            {
+                /* A member must start on a byte; GZ_INVFILE here only
+                   means that its header is not all there yet */
+                if(rs.pos / 8 >= insize ||
+                   gz_iszero(p, insize - rs.pos / 8))
+                {
+                    break;
+                }
+
+                result = gz_gzhead(p, insize - rs.pos / 8, &hlen);
+                if(result == GZ_INVFILE)
+                {
+                    result = GZ_OK;
+                    break;
+                }
+                if(result != GZ_OK)
+                {
+                    return(result);
+                }
+                o.crc = 0;
+                if(o.idx)
+                {
+                    gz_indexmark(&o, p, 0, 1);
+                }
+            }
+
+            rs.pos += 8 * hlen;
+            rs.inblock = 0;
+            o.start = o.ptr;
+            mbase = gz_outpos(&o);
+            st->state = GZ_STREAM_BLOCKS;
+        }
+        else if(st->state == GZ_STREAM_BLOCKS)
+        {
+            result = gz_inflate(&ins, &o, &rs);
+            if(result == GZ_END)
+            {
+                result = GZ_OK;
+                break;
+            }
+            if(result != GZ_OK)
+            {
+                return(result);
+            }
+
+            rs.pos = (rs.pos + 7) & ~7U;
+            st->state = (st->format == GZ_FMT_UNKNOWN) ?
+                GZ_STREAM_DONE : GZ_STREAM_TRAILER;
+        }
+        else if(st->state == GZ_STREAM_TRAILER)
+        {
+            if(st->format == GZ_FMT_ZLIB)
+            {
+                if(insize - rs.pos / 8 < 4)
+                {
+                    break;
+                }
+
+                if(o.adler != (((unsigned int)p[0] << 24) |
+                               ((unsigned int)p[1] << 16) |
+                               ((unsigned int)p[2] << 8) |
+                               (unsigned int)p[3]))
+                {
+                    return(GZ_INVCRC);
+                }
+                rs.pos += 32;
+                st->state = GZ_STREAM_DONE;
+            }
+            else
+            {
+                if(insize - rs.pos / 8 < 8)
+                {
+                    break;
+                }
+
+                if(o.crc != gz_read32le(p))
+                {
+                    return(GZ_INVCRC);
+                }
+
+                if(gz_outpos(&o) - mbase != gz_read32le(p + 4))
+                {
+                    return(GZ_INVFILE);
+                }
+                rs.pos += 64;
+                st->state = GZ_STREAM_HEAD;
+            }
+        }
+        else
+        {
+            result = GZ_END;
+        }
+    }
+
+    /* Keep the input from where decoding continues */
+    keep = (st->state == GZ_STREAM_BLOCKS && rs.inblock) ?
+        rs.hdrpos : rs.pos;
+    *used = keep / 8;
+    st->inblock = (st->state == GZ_STREAM_BLOCKS) ? rs.inblock : 0;
+    st->hdrpos = rs.hdrpos - *used * 8;
+    st->pos = rs.pos - *used * 8;
+    st->check = (st->format == GZ_FMT_ZLIB) ? o.adler : o.crc;
+    st->size = gz_outpos(&o) - mbase;
+    st->inpos += *used;
+    st->outpos = gz_outpos(&o);
+
+    /* Only the current member can be referred to; one that started in
+       this call moves to the front, which costs no more than its output
+       so far */
+    st->have = 0;
+    if(st->state == GZ_STREAM_BLOCKS || st->state == GZ_STREAM_TRAILER)
+    {
+        st->have = (unsigned int)(o.ptr - o.start);
+        for(i = 0;
+            o.start > o.base && i < st->have;
+            ++i)
+        {
+            o.base[i] = o.start[i];
+        }
+    }
+
+    return(result);
+}
+
+void
+gzstreamidle(gz_stream *st, gz_slab *slab)
+{
+    unsigned char *win, *p;
+    unsigned int keep, size, i;
+
+    if(st->have == 0)
+    {
+        gzslabfree(slab, st->win, st->winsize);
+        st->win = 0;
+        st->winsize = 0;
+        return;
+    }
+
+    /* Only the last GZ_WINDOW bytes can still be referred to */
+    keep = (st->have > GZ_WINDOW) ? GZ_WINDOW : st->have;
+    size = 1024U << gz_slabclass(keep);
+    if(size >= st->winsize)
+    {
+        return;
+    }
+
+    win = (unsigned char *)gzslaballoc(slab, size);
+    if(!win)
+    {
+        return;
+    }
+
+    p = st->win + st->have - keep;
+    for(i = 0;
+        i < keep;
+        ++i)
+    {
+        win[i] = p[i];
+    }
+    st->have = keep;
+    gzslabfree(slab, st->win, st->winsize);
+    st->win = win;
+    st->winsize = size;
+}
+
+void
+gzstreamend(gz_stream *st, gz_slab *slab)
+{
+    gzslabfree(slab, st->win, st->winsize);
+    st->win = 0;
+    st->winsize = 0;
+    st->have = 0;
+}
+
+/**
+  Random access through a checkpoint index. gzdecrange() decodes size
+  bytes from offset of the decoded data of in, starting at the last
+  point of idx at or before offset, so it costs at most the output
+  between two points rather than everything before offset. The window
+  is used as by gzdecstream() and must be at least 2 * GZ_WINDOW bytes.
+  *outlen falls short of size only where the data ends.
+
+  Indexes built by other tools are read with gzindexread() and written
+  with gzindexwrite(), so existing archives need no indexing pass:
+
+  - GZ_IDX_BGZIP, the .gzi of bgzip -i: BGZF block offsets, points
+    without history.
+  - GZ_IDX_GZTOOL, the .gzi of gztool: zran points with their windows
+    deflated (written back as stored blocks, which any inflate reads).
+    Line numbers of version 1 indexes are skipped.
+  - GZ_IDX_INDEXED_GZIP, export_index() of indexed_gzip.
+
+  Every point can hold GZ_WINDOW bytes of history, in memory the caller
+  provides (gzindexmem(n) bytes in all for n points):
+
+  gz_index idx;
+
+  n = gzindexcount(data, size);
+  gzindexinit(&idx, points, n, windows);
+  result = gzindexread(&idx, data, size);
+  result = gzdecrange(&idx, in, insize, offset, out, size, &outlen,
+                      window, sizeof(window));
+
+  Many ranges at once go through gzdecranges(). gzrangeplan() sorts the
+  requests by offset into order and merges them into spans, each
+  decoded once from a single point, so overlapping and nearby requests
+  share the work. Span s is order[spans[s]] up to order[spans[s + 1]];
+  spans needs nreqs + 1 entries. gzrangerun() decodes one span, for
+  callers with their own threads, and gzdecranges() does all of it,
+  spreading the spans over run in as many slots of at least
+  2 * GZ_WINDOW bytes as window holds (one slot without run). Every
+  request gets its own result and outlen.
+
+  A point keeps its input offset in bits in 32 bits, so indexes cover
+  up to 512 MiB of compressed input, and output offsets are 32 bits as
+  everywhere else in the library; an index with a point past either
+  limit gives GZ_UNSUPPORTED. Points of a bgzip index sit on gzip
+  headers rather than deflate blocks, so they are only written back as
+  bgzip.
+*/
+
+void
+gzindexinit(
+    gz_index *idx, gz_point *points, unsigned int maxpoints,
+    void *windows)
+{
+    idx->points = points;
+    idx->npoints = 0;
+    idx->maxpoints = maxpoints;
+    idx->windows = (unsigned char *)windows;
+    idx->size = 0;
+    idx->insize = 0;
+    idx->spacing = 1U << 20;
+    idx->truncated = 0;
+    idx->blooms = 0;
+    idx->bloomsize = 0;
+}
+
+static int
+gz_idmatch(unsigned char *p, const char *id, unsigned int n)
+{
+    unsigned int i;
+
+    for(i = 0;
+        i < n;
+        ++i)
+    {
+        if(p[i] != (unsigned char)id[i])
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+static void
+gz_idcopy(unsigned char *p, const char *id, unsigned int n)
+{
+    unsigned int i;
+
+    for(i = 0;
+        i < n;
+        ++i)
+    {
+        p[i] = (unsigned char)id[i];
+    }
+}
+
+static unsigned int
+gz_read32(unsigned char *p, int be)
+{
+    return(be ? gz_read32be(p) : gz_read32le(p));
+}
+
+/* 64-bit field of an index file; 0 if it does not fit in 32 bits */
+static int
+gz_read64(unsigned char *p, int be, unsigned int *v)
+{
+    *v = gz_read32(p + (be ? 4 : 0), be);
+    return(gz_read32(p + (be ? 0 : 4), be) == 0);
+}
+
+static void
+gz_put32(unsigned char *p, unsigned int v, int be)
+{
+    unsigned int i;
+
+    for(i = 0;
+        i < 4;
+        ++i)
+    {
+        p[be ? 3 - i : i] = (unsigned char)(v >> (8*i));
+    }
+}
+
+static void
+gz_put64(unsigned char *p, unsigned int v, int be)
+{
+    gz_put32(p + (be ? 4 : 0), v, be);
+    gz_put32(p + (be ? 0 : 4), 0, be);
+}
+
+static int
+gz_idxformat(unsigned char *p, unsigned int size)
+{
+    unsigned int n;
+
+    if(size >= 32 && gz_iszero(p, 8) && gz_idmatch(p + 8, "gzipind", 7) &&
+       (p[15] == 'x' || p[15] == 'X'))
+    {
+        return(GZ_IDX_GZTOOL);
+    }
+
+    if(size >= 35 && gz_idmatch(p, "GZIDX", 5))
+    {
+        return(GZ_IDX_INDEXED_GZIP);
+    }
+
+    if(size >= 8 && gz_read64(p, 0, &n) && n == (size - 8) / 16 &&
+       (size - 8) % 16 == 0)
+    {
+        return(GZ_IDX_BGZIP);
+    }
+
+    return(GZ_IDX_UNKNOWN);
+}
+
+/* The readers below only count the points when idx is 0 */
+
+/* Number of entries, then (compressed, uncompressed) offset pairs of
+   every BGZF block but the first, all 64-bit little endian */
+static int
+gz_bgzipidx(
+    gz_index *idx, unsigned char *p, unsigned int size,
+    unsigned int *count)
+{
+    unsigned int n, i, in, out;
+    int result;
+
+    if(!gz_read64(p, 0, &n) || n > (size - 8) / 16)
+    {
+        return(GZ_INVFILE);
+    }
+
+    *count = n + 1;
+    if(!idx)
+    {
+        return(GZ_OK);
+    }
+
+    result = gz_indexadd(idx, 0, 0, 0, 0);
+    for(i = 0;
+        i < n && result == GZ_OK;
+        ++i)
+    {
+        p += 16;
+        if(!gz_read64(p - 8, 0, &in) || !gz_read64(p, 0, &out) ||
+           in > 0x1fffffffU)
+        {
+            return(GZ_UNSUPPORTED);
+        }
+        result = gz_indexadd(idx, out, in * 8, 0, 0);
+    }
+
+    return(result);
+}
+
+/* Eight zero bytes, "gzipindx" ("gzipindX" with line numbers, then
+   their format in 32 bits), the point count twice (0 while gztool is
+   still writing), the points and the decoded size, all big endian. A
+   point is out and in (64 bits), bits and the size of its window
+   (32 bits), the window deflated, then the line number (64 bits). As in
+   zran, in is the first whole byte and bits come from the one before. */
+static int
+gz_gztoolidx(
+    gz_index *idx, unsigned char *p, unsigned int size,
+    unsigned int *count)
+{
+    gz_out o;
+    gz_bstream ins;
+    unsigned char *end, *win;
+    unsigned int n, i, out, in, bits, wsize, lines;
+    int result;
+
+    end = p + size;
+    lines = (p[15] == 'X');
+    p += lines ? 20 : 16;
+    if(end - p < 16)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(!gz_read64(p, 1, &n))
+    {
+        return(GZ_UNSUPPORTED);
+    }
+    p += 16;
+
+    for(i = 0;
+        n ? i < n : end - p > 8;
+        ++i)
+    {
+        if(end - p < 24)
+        {
+            return(GZ_INVFILE);
+        }
+
+        if(!gz_read64(p, 1, &out) || !gz_read64(p + 8, 1, &in) ||
+           in > 0x1fffffffU)
+        {
+            return(GZ_UNSUPPORTED);
+        }
+        bits = gz_read32be(p + 16);
+        wsize = gz_read32be(p + 20);
+        p += 24;
+
+        if(bits > 7 || bits > in * 8 || wsize > (unsigned int)(end - p) ||
+           (lines && (unsigned int)(end - p) - wsize < 8))
+        {
+            return(GZ_INVFILE);
+        }
+
+        if(idx)
+        {
+            win = 0;
+            o.ptr = o.start = 0;
+            if(wsize > 0)
+            {
+                if(!idx->windows || idx->npoints == idx->maxpoints)
+                {
+                    return(GZ_NOSPACE);
+                }
+
+                win = gz_pointwin(idx, idx->npoints);
+                gz_outinit(&o, win, GZ_WINDOW, 0, 0, 0);
+                if(gzformat(p, wsize) == GZ_FMT_ZLIB)
+                {
+                    result = gz_zlib(p, wsize, &o);
+                }
+                else
+                {
+                    o.check = GZ_CHECK_NONE;
+                    gz_bsinit(&ins, p, wsize);
+                    result = gz_inflate(&ins, &o, 0);
+                }
+                if(result != GZ_OK)
+                {
+                    return((result == GZ_NOSPACE) ? GZ_INVFILE : result);
+                }
+            }
+
+            result = gz_indexadd(idx, out, in * 8 - bits, win,
+                                 (unsigned int)(o.ptr - o.start));
+            if(result != GZ_OK)
+            {
+                return(result);
+            }
+        }
+
+        p += wsize + (lines ? 8 : 0);
+    }
+
+    if(idx && end - p >= 8 && !gz_read64(p, 1, &idx->size))
+    {
+        idx->size = 0;
+    }
+
+    *count = i;
+    return(GZ_OK);
+}
+
+/* "GZIDX", version, flags, compressed and decoded size (64 bits),
+   spacing, window size and point count (32 bits), the points, then the
+   windows of the points that have one, all little endian. A point is
+   its compressed and decoded offset (64 bits), bits as for gztool and,
+   from version 1 on, whether it has a window (8 bits each); in version
+   0 all but the first have one. */
+static int
+gz_igzipidx(
+    gz_index *idx, unsigned char *p, unsigned int size,
+    unsigned int *count)
+{
+    unsigned char *end, *pt, *win;
+    unsigned int n, i, in, out, psize, wsize, hasdata;
+    int result;
+
+    if(p[5] > 1)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    end = p + size;
+    psize = p[5] ? 18 : 17;
+    n = gz_read32le(p + 31);
+    if(n > (size - 35) / psize)
+    {
+        return(GZ_INVFILE);
+    }
+
+    *count = n;
+    if(!idx)
+    {
+        return(GZ_OK);
+    }
+
+    if(!gz_read64(p + 7, 0, &idx->insize) ||
+       !gz_read64(p + 15, 0, &idx->size))
+    {
+        return(GZ_UNSUPPORTED);
+    }
+    idx->spacing = gz_read32le(p + 23);
+    wsize = gz_read32le(p + 27);
+
+    pt = p + 35;
+    win = pt + n * psize;
+    for(i = 0;
+        i < n;
+        ++i)
+    {
+        if(!gz_read64(pt, 0, &in) || !gz_read64(pt + 8, 0, &out) ||
+           in > 0x1fffffffU)
+        {
+            return(GZ_UNSUPPORTED);
+        }
+
+        hasdata = p[5] ? pt[17] : (i > 0);
+        if(pt[16] > 7 || pt[16] > in * 8 ||
+           (hasdata && wsize > (unsigned int)(end - win)))
+        {
+            return(GZ_INVFILE);
+        }
+
+        result = gz_indexadd(idx, out, in * 8 - pt[16],
+                             win, hasdata ? wsize : 0);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+
+        win += hasdata ? wsize : 0;
+        pt += psize;
+    }
+
+    return(GZ_OK);
+}
+
+unsigned int
+gzindexcount(void *data, unsigned int size)
+{
+    unsigned char *p;
+    unsigned int count;
+    int format, result;
+
+    p = (unsigned char *)data;
+    if(!p)
+    {
+        return(0);
+    }
+
+    format = gz_idxformat(p, size);
+    if(format == GZ_IDX_BGZIP)
+    {
+        result = gz_bgzipidx(0, p, size, &count);
+    }
+    else if(format == GZ_IDX_GZTOOL)
+    {
+        result = gz_gztoolidx(0, p, size, &count);
+    }
+    else if(format == GZ_IDX_INDEXED_GZIP)
+    {
+        result = gz_igzipidx(0, p, size, &count);
+    }
+    else
+    {
+        result = GZ_INVMAGIC;
+    }
+
+    return((result == GZ_OK) ? count : 0);
+}
+
+int
+gzindexread(gz_index *idx, void *data, unsigned int size)
+{
+    unsigned char *p;
+    unsigned int count;
+    int format;
+
+    p = (unsigned char *)data;
+    idx->npoints = 0;
+    idx->blooms = 0;
+    if(!p)
+    {
+        return(GZ_INVFILE);
+    }
+
+    format = gz_idxformat(p, size);
+    if(format == GZ_IDX_BGZIP)
+    {
+        return(gz_bgzipidx(idx, p, size, &count));
+    }
+    else if(format == GZ_IDX_GZTOOL)
+    {
+        return(gz_gztoolidx(idx, p, size, &count));
+    }
+    else if(format == GZ_IDX_INDEXED_GZIP)
+    {
+        return(gz_igzipidx(idx, p, size, &count));
+    }
+
+    return(GZ_INVMAGIC);
+}
+
+/* A point's history as the GZ_WINDOW bytes zran points hold, zeros
+   first where it is shorter; *adler runs over all of them */
+static int
+gz_putwin(
+    gz_index *idx, unsigned int i, gz_sinkfn sink, void *user,
+    unsigned int *adler)
+{
+    unsigned char zero[64];
+    unsigned int pad, n;
+
+    gz_memset(zero, 0, sizeof(zero));
+    pad = GZ_WINDOW - idx->points[i].winsize;
+    while(pad > 0)
+    {
+        n = (pad > sizeof(zero)) ? (unsigned int)sizeof(zero) : pad;
+        *adler = gzadler32(*adler, zero, n);
+        if(sink(user, zero, n))
+        {
+            return(GZ_ABORTED);
+        }
+        pad -= n;
+    }
+
+    n = idx->points[i].winsize;
+    *adler = gzadler32(*adler, gz_pointwin(idx, i), n);
+    if(n > 0 && sink(user, gz_pointwin(idx, i), n))
+    {
+        return(GZ_ABORTED);
+    }
+
+    return(GZ_OK);
+}
+
+int
+gzindexwrite(gz_index *idx, int format, gz_sinkfn sink, void *user)
+{
+    /* zlib header and a final stored block of GZ_WINDOW bytes */
+    static unsigned char stored[7] = {
+        0x78, 0x01, 0x01, 0x00, 0x80, 0xff, 0x7f
+    };
+    unsigned char buf[40];
+    gz_point *pt;
+    unsigned int i, n, adler;
+    int result;
+
+    if(format == GZ_IDX_BGZIP)
+    {
+        n = 0;
+        for(i = 0;
+            i < idx->npoints;
+            ++i)
+        {
+            pt = &idx->points[i];
+            if(pt->out > 0 && (pt->winsize > 0 || pt->in % 8))
+            {
+                return(GZ_UNSUPPORTED);
+            }
+            n += (pt->out > 0);
+        }
+
+        gz_put64(buf, n, 0);
+        if(sink(user, buf, 8))
+        {
+            return(GZ_ABORTED);
+        }
+
+        for(i = 0;
+            i < idx->npoints;
+            ++i)
+        {
+            pt = &idx->points[i];
+            gz_put64(buf, pt->in / 8, 0);
+            gz_put64(buf + 8, pt->out, 0);
+            if(pt->out > 0 && sink(user, buf, 16))
+            {
+                return(GZ_ABORTED);
+            }
+        }
+    }
+    else if(format == GZ_IDX_GZTOOL)
+    {
+        gz_memset(buf, 0, 8);
+        gz_idcopy(buf + 8, "gzipindx", 8);
+        gz_put64(buf + 16, idx->npoints, 1);
+        gz_put64(buf + 24, idx->npoints, 1);
+        if(sink(user, buf, 32))
+        {
+            return(GZ_ABORTED);
+        }
+
+        for(i = 0;
+            i < idx->npoints;
+            ++i)
+        {
+            pt = &idx->points[i];
+            gz_put64(buf, pt->out, 1);
+            gz_put64(buf + 8, (pt->in + 7) / 8, 1);
+            gz_put32(buf + 16, (8 - pt->in % 8) % 8, 1);
+            n = pt->winsize ? (unsigned int)sizeof(stored) + GZ_WINDOW + 4 : 0;
+            gz_put32(buf + 20, n, 1);
+            if(sink(user, buf, 24))
+            {
+                return(GZ_ABORTED);
+            }
+
+            if(pt->winsize > 0)
+            {
+                adler = 1;
+                if(sink(user, stored, sizeof(stored)))
+                {
+                    return(GZ_ABORTED);
+                }
+                result = gz_putwin(idx, i, sink, user, &adler);
+                if(result != GZ_OK)
+                {
+                    return(result);
+                }
+                gz_put32(buf, adler, 1);
+                if(sink(user, buf, 4))
+                {
+                    return(GZ_ABORTED);
+                }
+            }
+        }
+
+        gz_put64(buf, idx->size, 1);
+        if(sink(user, buf, 8))
+        {
+            return(GZ_ABORTED);
+        }
+    }
+    else if(format == GZ_IDX_INDEXED_GZIP)
+    {
+        gz_idcopy(buf, "GZIDX", 5);
+        buf[5] = 1;
+        buf[6] = 0;
+        gz_put64(buf + 7, idx->insize, 0);
+        gz_put64(buf + 15, idx->size, 0);
+        gz_put32(buf + 23, idx->spacing, 0);
+        gz_put32(buf + 27, GZ_WINDOW, 0);
+        gz_put32(buf + 31, idx->npoints, 0);
+        if(sink(user, buf, 35))
+        {
+            return(GZ_ABORTED);
+        }
+
+        for(i = 0;
+            i < idx->npoints;
+            ++i)
+        {
+            pt = &idx->points[i];
+            gz_put64(buf, (pt->in + 7) / 8, 0);
+            gz_put64(buf + 8, pt->out, 0);
+            buf[16] = (unsigned char)((8 - pt->in % 8) % 8);
+            buf[17] = (pt->winsize > 0);
+            if(sink(user, buf, 18))
+            {
+                return(GZ_ABORTED);
+            }
+        }
+
+        for(i = 0;
+            i < idx->npoints;
+            ++i)
+        {
+            adler = 1;
+            if(idx->points[i].winsize > 0)
+            {
+                result = gz_putwin(idx, i, sink, user, &adler);
+                if(result != GZ_OK)
+                {
+                    return(result);
+                }
+            }
+        }
+    }
+    else
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    return(GZ_OK);
+}
+
+/* Last point at or before offset, npoints if there is none */
+static unsigned int
+gz_indexfind(gz_index *idx, unsigned int offset)
+{
+    unsigned int lo, hi, mid;
+
+    lo = 0;
+    hi = idx->npoints;
+    while(lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if(idx->points[mid].out <= offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return(lo ? lo - 1 : idx->npoints);
+}
+
+/* Sink handing the output to the requests order[first..last), sorted
+   by offset, until pos (the offset of the next byte it gets) reaches
+   to */
+typedef struct
+gz_span
+{
+    gz_req *reqs;
+    unsigned int *order;
+    unsigned int first;
+    unsigned int last;
+    unsigned int pos;
+    unsigned int to;
+} gz_span;
+
+static unsigned int
+gz_reqend(gz_req *req)
+{
+    return((req->offset + req->size < req->offset) ?
+           0xffffffffU : req->offset + req->size);
+}
+
+static int
+gz_spansink(void *user, void *data, unsigned int size)
+{
+    gz_span *s;
+    gz_req *req;
+    unsigned char *p, *out;
+    unsigned int i, a, b, end;
+
+    s = (gz_span *)user;
+    p = (unsigned char *)data;
+    end = (s->to - s->pos < size) ? s->to : s->pos + size;
+    for(i = s->first;
+        i < s->last;
+        ++i)
+    {
+        req = &s->reqs[s->order[i]];
+        if(req->offset >= end)
+        {
+            break;
+        }
+
+        a = (s->pos > req->offset) ? s->pos : req->offset;
+        b = (gz_reqend(req) < end) ? gz_reqend(req) : end;
+        out = (unsigned char *)req->out;
+        while(a < b)
+        {
+            out[a - req->offset] = p[a - s->pos];
+            ++a;
+        }
+    }
+
+    s->pos += size;
+    return(s->pos >= s->to);
+}
+
+/* Decode from point i of idx (from the start of in if i is npoints)
+   into the window o, which has just been set up */
+static int
+gz_pointdec(
+    gz_index *idx, unsigned int i,
+    unsigned char *in, unsigned int insize, gz_out *o)
+{
+    gz_bstream ins;
+    gz_resume rs;
+    gz_point start, *pt;
+    unsigned char *p, *win;
+    unsigned int j;
+    int format, result;
+
+    format = gzformat(in, insize);
+    pt = &start;
+    start.out = 0;
+    start.in = (format == GZ_FMT_ZLIB) ? 16 : 0;
+    start.winsize = 0;
+    if(i < idx->npoints)
+    {
+        pt = &idx->points[i];
+    }
+
+    if(pt->in / 8 >= insize)
+    {
+        return(GZ_INVFILE);
+    }
+
+    /* A deflate block never starts with 0x1f, as its type would be 3 */
+    p = in + pt->in / 8;
+    if(pt->winsize == 0 && pt->in % 8 == 0 && p[0] == 0x1f)
+    {
+        o->slid = pt->out;
+        return(gz_members(p, insize - pt->in / 8, o));
+    }
+
+    win = (pt->winsize > 0) ? gz_pointwin(idx, i) : 0;
+    for(j = 0;
+        j < pt->winsize;
+        ++j)
+    {
+        o->base[j] = win[j];
+    }
+    o->ptr = o->base + pt->winsize;
+    o->flushp = o->ptr;
+    o->slid = pt->out - pt->winsize;
+    o->check = GZ_CHECK_NONE;
+
+    rs.inblock = 0;
+    rs.hdrpos = 0;
+    rs.pos = pt->in;
+    gz_bsinit(&ins, in, insize);
+    result = gz_inflate(&ins, o, &rs);
+    if(result == GZ_END)
+    {
+        result = GZ_INVFILE;
+    }
+
+    if(result != GZ_OK || (format != GZ_FMT_GZIP && format != GZ_FMT_BGZF))
+    {
+        return(result);
+    }
+
+    /* The rest of the member was checked by nothing; skip its trailer
+       and go on with the members after it */
+    j = (rs.pos + 7) / 8 + 8;
+    if(j > insize)
+    {
+        return(GZ_INVFILE);
+    }
+
+    return(gz_members(in + j, insize - j, o));
+}
+
+/* Decode the requests order[first..last), sorted by offset, in one
+   go from the last point before the first of them */
+static int
+gz_spandec(
+    gz_index *idx, unsigned char *in, unsigned int insize,
+    gz_req *reqs, unsigned int *order, unsigned int first, unsigned int last,
+    void *window, unsigned int windowsize)
+{
+    gz_out o;
+    gz_span s;
+    gz_req *req;
+    unsigned int i, p;
+    int result;
+
+    s.reqs = reqs;
+    s.order = order;
+    s.first = first;
+    s.last = last;
+    s.to = 0;
+    for(i = first;
+        i < last;
+        ++i)
+    {
+        req = &reqs[order[i]];
+        req->outlen = 0;
+        if(gz_reqend(req) > s.to)
+        {
+            s.to = gz_reqend(req);
+        }
+    }
+
+    result = GZ_OK;
+    if(!in || !window)
+    {
+        result = GZ_INVFILE;
+    }
+    else if(windowsize < 2*GZ_WINDOW)
+    {
+        result = GZ_NOSPACE;
+    }
+    else if(first < last && s.to > reqs[order[first]].offset)
+    {
+        p = gz_indexfind(idx, reqs[order[first]].offset);
+        s.pos = (p < idx->npoints) ? idx->points[p].out : 0;
+
+        gz_outinit(&o, window, windowsize, gz_spansink, &s, 0);
+        o.window = 1;
+        result = gz_pointdec(idx, p, in, insize, &o);
+        if(result == GZ_ABORTED && s.pos >= s.to)
+        {
+            result = GZ_OK;
+        }
+
+        for(i = first;
+            i < last;
+            ++i)
+        {
+            req = &reqs[order[i]];
+            if(s.pos > req->offset)
+            {
+                req->outlen = ((s.pos < gz_reqend(req)) ?
+                               s.pos : gz_reqend(req)) - req->offset;
+            }
+        }
+    }
+
+    for(i = first;
+        i < last;
+        ++i)
+    {
+        reqs[order[i]].result = result;
+    }
+
+    return(result);
+}
+
+int
+gzdecrange(
+    gz_index *idx, void *in, unsigned int insize,
+    unsigned int offset, void *out, unsigned int size,
+    unsigned int *outlen, void *window, unsigned int windowsize)
+{
+    gz_req req;
+    unsigned int order;
+    int result;
+
+    *outlen = 0;
+    if(!out)
+    {
+        return(GZ_INVFILE);
+    }
+
+    req.offset = offset;
+    req.size = size;
+    req.out = out;
+    order = 0;
+    result = gz_spandec(idx, (unsigned char *)in, insize, &req, &order,
+                        0, 1, window, windowsize);
+    *outlen = req.outlen;
+
+    return(result);
+}
+
+/* Sift down for a heap ordered with the largest offset on top */
+static void
+gz_reqsift(gz_req *reqs, unsigned int *order, unsigned int i, unsigned int n)
+{
+    unsigned int child, tmp;
+
+    for(;;)
+    {
+        child = 2*i + 1;
+        if(child >= n)
+        {
+            break;
+        }
+
+        if(child + 1 < n &&
+           reqs[order[child + 1]].offset > reqs[order[child]].offset)
+        {
+            ++child;
+        }
+
+        if(reqs[order[i]].offset >= reqs[order[child]].offset)
+        {
+            break;
+        }
+
+        tmp = order[i];
+        order[i] = order[child];
+        order[child] = tmp;
+        i = child;
+    }
+}
+
+unsigned int
+gzrangeplan(
+    gz_index *idx, gz_req *reqs, unsigned int nreqs,
+    unsigned int *order, unsigned int *spans)
+{
+    unsigned int i, n, p, start, end, tmp;
+
+    for(i = 0;
+        i < nreqs;
+        ++i)
+    {
+        order[i] = i;
+    }
+
+    for(i = nreqs / 2;
+        i > 0;
+        --i)
+    {
+        gz_reqsift(reqs, order, i - 1, nreqs);
+    }
+
+    for(i = nreqs;
+        i > 1;
+        --i)
+    {
+        tmp = order[0];
+        order[0] = order[i - 1];
+        order[i - 1] = tmp;
+        gz_reqsift(reqs, order, 0, i - 1);
+    }
+
+    /* Go on with the span decoded so far unless the next request has a
+       point of its own past its end */
+    n = 0;
+    end = 0;
+    for(i = 0;
+        i < nreqs;
+        ++i)
+    {
+        p = gz_indexfind(idx, reqs[order[i]].offset);
+        start = (p < idx->npoints) ? idx->points[p].out : 0;
+        if(n == 0 || start > end)
+        {
+            spans[n++] = i;
+            end = 0;
+        }
+
+        if(gz_reqend(&reqs[order[i]]) > end)
+        {
+            end = gz_reqend(&reqs[order[i]]);
+        }
+    }
+    spans[n] = nreqs;
+
+    return(n);
+}
+
+int
+gzrangerun(
+    gz_index *idx, void *in, unsigned int insize,
+    gz_req *reqs, unsigned int *order,
+    unsigned int first, unsigned int last,
+    void *window, unsigned int windowsize)
+{
+    return(gz_spandec(idx, (unsigned char *)in, insize, reqs, order,
+                      first, last, window, windowsize));
+}
+
+typedef struct
+gz_rangetask
+{
+    gz_index *idx;
+    unsigned char *in;
+    unsigned int insize;
+    gz_req *reqs;
+    unsigned int *order;
+    unsigned int *spans;
+    unsigned int nspans;
+    unsigned int nslots;
+    unsigned char *window;
+    unsigned int slotsize;
+} gz_rangetask;
+
+/* Slot index decodes spans index, index + nslots, ... */
+static void
+gz_rangetaskfn(void *arg, unsigned int index)
+{
+    gz_rangetask *t;
+    unsigned int s;
+
+    t = (gz_rangetask *)arg;
+    for(s = index;
+        s < t->nspans;
+        s += t->nslots)
+    {
+        gz_spandec(t->idx, t->in, t->insize, t->reqs, t->order,
+                   t->spans[s], t->spans[s + 1],
+                   t->window + index * t->slotsize, t->slotsize);
+    }
+}
+
+int
+gzdecranges(
+    gz_index *idx, void *in, unsigned int insize,
+    gz_req *reqs, unsigned int nreqs,
+    unsigned int *order, unsigned int *spans,
+    void *window, unsigned int windowsize,
+    gz_runfn run, void *user)
+{
+    gz_rangetask t;
+    unsigned int i;
+
+    t.idx = idx;
+    t.in = (unsigned char *)in;
+    t.insize = insize;
+    t.reqs = reqs;
+    t.order = order;
+    t.spans = spans;
+    t.nspans = gzrangeplan(idx, reqs, nreqs, order, spans);
+    t.window = (unsigned char *)window;
+
+    /* As many slots of at least 2 * GZ_WINDOW as there are spans */
+    t.nslots = run ? windowsize / (2*GZ_WINDOW) : 1;
+    if(t.nslots > t.nspans)
+    {
+        t.nslots = t.nspans;
+    }
+    if(t.nslots == 0)
+    {
+        t.nslots = 1;
+    }
+    t.slotsize = windowsize / t.nslots;
+
+    if(t.nslots > 1)
+    {
+        run(user, gz_rangetaskfn, &t, t.nslots);
+    }
+    else
+    {
+        gz_rangetaskfn(&t, 0);
+    }
+
+    for(i = 0;
+        i < nreqs;
+        ++i)
+    {
+        if(reqs[i].result != GZ_OK)
+        {
+            return(reqs[i].result);
+        }
+    }
+
+    return(GZ_OK);
+}
+
+/**
+  Reads through a checkpoint index that keep the decoder where the last
+  one stopped. gzreaderread() reads size bytes from offset like
+  gzdecrange(), but goes on from the decoder's position instead of a
+  point when that is no further back, so reading a file in ascending
+  ranges decodes it once, as a stream would. Decoding stops at the first
+  place it can resume from past the read, and the few bytes beyond it
+  are kept in the read-ahead buffer (at least GZ_AHEAD_MIN bytes).
+
+  When reads follow each other (r->seq is non-zero), gzreaderahead()
+  decodes ahead until all but GZ_AHEAD_MIN bytes of the buffer are
+  full, so the next reads are served from it. It is meant for a
+  background thread, between reads: it may run while the caller uses
+  the data of the last read, but never at the same time as
+  gzreaderread() on the same reader.
+
+  gz_reader r;
+
+  gzreaderinit(&r, &idx, in, insize, window, sizeof(window),
+               ahead, sizeof(ahead));
+  result = gzreaderread(&r, offset, out, size, &outlen);
+  if(r.seq)
+  {
+      (start gzreaderahead(&r) on a worker, join before the next read)
+  }
+
+  The window must be at least 2 * GZ_WINDOW bytes. Checksums are
+  verified for members the decoder went through from their start.
+*/
+
+void
+gzreaderinit(
+    gz_reader *r, gz_index *idx, void *in, unsigned int insize,
+    void *window, unsigned int windowsize,
+    void *buf, unsigned int bufsize)
+{
+    r->idx = idx;
+    r->in = (unsigned char *)in;
+    r->insize = insize;
+    r->format = gzformat(in, insize);
+    r->window = (unsigned char *)window;
+    r->windowsize = windowsize;
+    r->have = 0;
+    r->buf = (unsigned char *)buf;
+    r->bufsize = bufsize;
+    r->bufpos = 0;
+    r->buflen = 0;
+    r->positioned = 0;
+    r->state = GZ_STREAM_HEAD;
+    r->inblock = 0;
+    r->hdrpos = 0;
+    r->pos = 0;
+    r->outpos = 0;
+    r->check = 0;
+    r->verify = 0;
+    r->mstart = 0;
+    r->last = 0;
+    r->seq = 0;
+}
+
+/* Move the decoder to point i of the index, or to the start if i is
+   npoints */
+static void
+gz_readseek(gz_reader *r, unsigned int i)
+{
+    gz_index *idx;
+    gz_point *pt;
+    unsigned char *win;
+    unsigned int j;
+
+    idx = r->idx;
+    r->positioned = 1;
+    r->inblock = 0;
+    r->have = 0;
+    r->verify = 0;
+    if(i == idx->npoints)
+    {
+        r->state = (r->format == GZ_FMT_UNKNOWN) ?
+            GZ_STREAM_BLOCKS : GZ_STREAM_HEAD;
+        r->pos = 0;
+        r->outpos = 0;
+    }
+    else
+    {
+        pt = &idx->points[i];
+        r->pos = pt->in;
+        r->outpos = pt->out;
+        r->state = GZ_STREAM_BLOCKS;
+        if(pt->winsize == 0 && pt->in % 8 == 0 && pt->in / 8 < r->insize &&
+           r->in[pt->in / 8] == 0x1f)
+        {
+            r->state = GZ_STREAM_HEAD;
+        }
+
+        win = (pt->winsize > 0) ? gz_pointwin(idx, i) : 0;
+        for(j = 0;
+            j < pt->winsize;
+            ++j)
+        {
+            r->window[j] = win[j];
+        }
+        r->have = pt->winsize;
+    }
+
+    r->bufpos = r->outpos;
+    r->buflen = 0;
+}
+
+/* Sink for the decoder of a reader: output in from..to goes to out, any
+   after to into the read-ahead buffer, which starts at to */
+typedef struct
+gz_readto
+{
+    gz_reader *r;
+    unsigned char *out;
+    unsigned int from;
+    unsigned int to;
+    unsigned int pos;
+} gz_readto;
+
+static int
+gz_readsink(void *user, void *data, unsigned int size)
+{
+    gz_readto *t;
+    gz_reader *r;
+    unsigned char *p;
+    unsigned int a, b, end;
+
+    t = (gz_readto *)user;
+    r = t->r;
+    p = (unsigned char *)data;
+    end = (0xffffffffU - t->pos < size) ? 0xffffffffU : t->pos + size;
+
+    a = (t->pos > t->from) ? t->pos : t->from;
+    b = (end < t->to) ? end : t->to;
+    while(a < b)
+    {
+        t->out[a - t->from] = p[a - t->pos];
+        ++a;
+    }
+
+    a = (t->pos > t->to) ? t->pos : t->to;
+    b = (0xffffffffU - r->bufpos < r->bufsize) ?
+        0xffffffffU : r->bufpos + r->bufsize;
+    if(b > end)
+    {
+        b = end;
+    }
+    while(a < b)
+    {
+        r->buf[a - r->bufpos] = p[a - t->pos];
+        ++a;
+    }
+    if(b > r->bufpos + r->buflen)
+    {
+        r->buflen = b - r->bufpos;
+    }
+
+    t->pos = end;
+    return(0);
+}
+
+/* Run the decoder of r up to the first place to stop at past limit, or
+   to the end of the data */
+static int
+gz_readdec(gz_reader *r, unsigned int limit, gz_readto *t)
+{
+    gz_out o;
+    gz_bstream ins;
+    gz_resume rs;
+    unsigned char *p;
+    unsigned int hlen, left;
+    int result;
+
+    gz_outinit(&o, r->window, r->windowsize, gz_readsink, t, 0);
+    o.window = 1;
+    o.ptr = o.base + r->have;
+    o.flushp = o.ptr;
+    o.slid = r->outpos - r->have;
+    o.limit = limit;
+    o.check = !r->verify ? GZ_CHECK_NONE :
+              (r->format == GZ_FMT_ZLIB) ? GZ_CHECK_ADLER : GZ_CHECK_CRC;
+    o.crc = r->check;
+    o.adler = r->check;
+    t->pos = r->outpos;
+
+    rs.inblock = r->inblock;
+    rs.hdrpos = r->hdrpos;
+    rs.pos = r->pos;
+    gz_bsinit(&ins, r->in, r->insize);
+
+    result = GZ_OK;
+    while(result == GZ_OK && r->state != GZ_STREAM_DONE &&
+          gz_outpos(&o) < limit)
+    {
+        p = r->in + rs.pos / 8;
+        left = (rs.pos / 8 < r->insize) ? r->insize - rs.pos / 8 : 0;
+        if(r->state == GZ_STREAM_HEAD)
+        {
+            if(r->format == GZ_FMT_ZLIB)
+            {
+                if(left < 2)
+                {
+                    result = GZ_INVFILE;
+                    break;
+                }
+                hlen = 2;
+                o.check = GZ_CHECK_ADLER;
+                o.adler = 1;
+            }
+            else
+            {
+                if(left == 0 || gz_iszero(p, left))
+                {
+                    r->state = GZ_STREAM_DONE;
+                    break;
+                }
+
+                result = gz_gzhead(p, left, &hlen);
+                if(result != GZ_OK)
+                {
+                    break;
+                }
+                o.check = GZ_CHECK_CRC;
+                o.crc = 0;
+            }
+
+            rs.pos += 8 * hlen;
+            rs.inblock = 0;
+            o.start = o.ptr;
+            r->verify = 1;
+            r->mstart = gz_outpos(&o);
+            r->state = GZ_STREAM_BLOCKS;
+        }
+        else if(r->state == GZ_STREAM_BLOCKS)
+        {
+            result = gz_inflate(&ins, &o, &rs);
+            if(result == GZ_END)
+            {
+                result = ins.overrun ? GZ_INVFILE : GZ_OK;
+                break;
+            }
+            if(result != GZ_OK)
+            {
+                break;
+            }
+
+            rs.pos = (rs.pos + 7) & ~7U;
+            r->state = (r->format == GZ_FMT_UNKNOWN) ?
+                GZ_STREAM_DONE : GZ_STREAM_TRAILER;
+        }
+        else
+        {
+            if(left < ((r->format == GZ_FMT_ZLIB) ? 4U : 8U))
+            {
+                result = GZ_INVFILE;
+                break;
+            }
+
+            if(r->verify && r->format == GZ_FMT_ZLIB &&
+               o.adler != gz_read32be(p))
+            {
+                result = GZ_INVCRC;
+                break;
+            }
+            if(r->verify && r->format != GZ_FMT_ZLIB &&
+               o.crc != gz_read32le(p))
+            {
+                result = GZ_INVCRC;
+                break;
+            }
+            if(r->verify && r->format != GZ_FMT_ZLIB &&
+               gz_outpos(&o) - r->mstart != gz_read32le(p + 4))
+            {
+                result = GZ_INVFILE;
+                break;
+            }
+
+            rs.pos += (r->format == GZ_FMT_ZLIB) ? 32 : 64;
+            r->state = (r->format == GZ_FMT_ZLIB) ?
+                GZ_STREAM_DONE : GZ_STREAM_HEAD;
+        }
+    }
+
+    if(result != GZ_OK)
+    {
+        /* Start over from a point on the next read */
+        r->positioned = 0;
+        return(result);
+    }
+
+    r->inblock = rs.inblock;
+    r->hdrpos = rs.hdrpos;
+    r->pos = rs.pos;
+    r->have = (unsigned int)(o.ptr - o.base);
+    r->outpos = gz_outpos(&o);
+    r->check = (r->format == GZ_FMT_ZLIB) ? o.adler : o.crc;
+
+    return(GZ_OK);
+}
+
+int
+gzreaderread(
+    gz_reader *r, unsigned int offset, void *out, unsigned int size,
+    unsigned int *outlen)
+{
+    gz_readto t;
+    unsigned char *dst;
+    unsigned int i, n, end, p;
+    int result;
+
+    *outlen = 0;
+    if(!r->in || !r->window || !r->buf || !out)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(r->windowsize < 2*GZ_WINDOW || r->bufsize < GZ_AHEAD_MIN)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    end = (offset + size < offset) ? 0xffffffffU : offset + size;
+    r->seq = (offset == r->last && offset > 0) ? r->seq + 1 : 0;
+    r->last = end;
+
+    /* What was decoded ahead */
+    dst = (unsigned char *)out;
+    if(offset >= r->bufpos && offset - r->bufpos < r->buflen)
+    {
+        n = r->buflen - (offset - r->bufpos);
+        if(n > end - offset)
+        {
+            n = end - offset;
+        }
+        for(i = 0;
+            i < n;
+            ++i)
+        {
+            dst[i] = r->buf[offset - r->bufpos + i];
+        }
+        *outlen = n;
+        offset += n;
+        dst += n;
+    }
+
+    if(offset == end)
+    {
+        return(GZ_OK);
+    }
+
+    /* Go on from where the decoder is unless a point is closer */
+    p = gz_indexfind(r->idx, offset);
+    if(!r->positioned || r->outpos > offset ||
+       (p < r->idx->npoints && r->idx->points[p].out > r->outpos))
+    {
+        gz_readseek(r, p);
+    }
+
+    t.r = r;
+    t.out = dst;
+    t.from = offset;
+    t.to = end;
+    r->bufpos = end;
+    r->buflen = 0;
+    result = gz_readdec(r, end, &t);
+    if(t.pos > offset)
+    {
+        *outlen += ((t.pos < end) ? t.pos : end) - offset;
+    }
+
+    return(result);
+}
+
+int
+gzreaderahead(gz_reader *r)
+{
+    gz_readto t;
+    unsigned int drop, i;
+
+    if(!r->positioned || r->state == GZ_STREAM_DONE ||
+       r->bufsize < GZ_AHEAD_MIN)
+    {
+        return(GZ_OK);
+    }
+
+    /* The buffer must end where the decoder stands */
+    if(r->bufpos + r->buflen != r->outpos)
+    {
+        r->bufpos = r->outpos;
+        r->buflen = 0;
+    }
+
+    /* Drop what has been read, once that is worth moving the rest */
+    drop = 0;
+    if(r->last > r->bufpos)
+    {
+        drop = (r->last - r->bufpos < r->buflen) ?
+            r->last - r->bufpos : r->buflen;
+    }
+    if(drop > 0 && (drop >= r->bufsize / 2 || drop == r->buflen))
+    {
+        for(i = drop;
+            i < r->buflen;
+            ++i)
+        {
+            r->buf[i - drop] = r->buf[i];
+        }
+        r->bufpos += drop;
+        r->buflen -= drop;
+    }
+
+    if(r->bufsize - r->buflen < GZ_AHEAD_MIN)
+    {
+        return(GZ_OK);
+    }
+
+    t.r = r;
+    t.out = 0;
+    t.from = r->outpos;
+    t.to = r->outpos;
+    return(gz_readdec(r, r->bufpos + (r->bufsize - GZ_AHEAD_MIN), &t));
+}
+
+/**
+  Searches of a file through its index. With filters set up by
+  gzindexbloom() before gzdecindex() (or before the first gzstreamdec()
+  of a stream recording into idx), every chunk of output between two
+  points gets a Bloom filter of the byte trigrams that end in it, and
+  gzindexsearch() decodes only the chunks a match of needle could start
+  in: those where each of its trigrams is in the filter of a chunk the
+  match would reach. Consecutive candidates are decoded in one go, from
+  the point before the first. Without filters, or for needles shorter
+  than three bytes, the whole file is searched.
+
+  blooms holds maxpoints + 1 filters of bloomsize bytes, a power of two
+  (rounded down otherwise). One byte per distinct trigram of a chunk
+  lets about 3% of absent trigrams through, and a chunk is skipped once
+  any trigram of the needle is absent; logs repeat most of theirs, so
+  filters much smaller than the chunks do. Filling them costs a hash
+  and GZ_BLOOMK bit sets per byte of output while indexing. They are
+  plain bytes: store them next to the index, and attach them again
+  after gzindexread(), which drops them.
+
+  gzindexbloom(&idx, blooms, bloomsize);
+  result = gzdecindex(in, insize, window, sizeof(window), &outlen,
+                      sink, user, &idx);
+  result = gzindexsearch(&idx, in, insize, "timeout", 7,
+                         window, sizeof(window), match, user);
+
+  match is called with the output offset of every match, in ascending
+  order, and stops the search with GZ_ABORTED when it returns non-zero.
+  Needles are up to GZ_WINDOW bytes (GZ_UNSUPPORTED otherwise) and the
+  window must be at least 2 * GZ_WINDOW bytes.
+*/
+
+void
+gzindexbloom(gz_index *idx, void *blooms, unsigned int bloomsize)
+{
+    while(bloomsize & (bloomsize - 1))
+    {
+        bloomsize &= bloomsize - 1;
+    }
+
+    idx->blooms = bloomsize ? (unsigned char *)blooms : 0;
+    idx->bloomsize = bloomsize;
+}
+
+/* Output chunk k of idx, from point k - 1 (the start for k = 0) up to
+   point k (the end for k = npoints) */
+static unsigned int
+gz_chunkstart(gz_index *idx, unsigned int k)
+{
+    return(k ? idx->points[k - 1].out : 0);
+}
+
+static unsigned int
+gz_chunkend(gz_index *idx, unsigned int k)
+{
+    if(k < idx->npoints)
+    {
+        return(idx->points[k].out);
+    }
+
+    return(idx->size ? idx->size : 0xffffffffU);
+}
+
+/* Whether a match of the len bytes of needle may start in chunk k */
+static int
+gz_chunkmay(
+    gz_index *idx, unsigned int k, unsigned char *needle, unsigned int len)
+{
+    unsigned int reach, e, c, g, i;
+
+    if(!idx->blooms || len < 3)
+    {
+        return(1);
+    }
+
+    /* Chunks k..e hold the bytes of any such match */
+    reach = gz_chunkend(idx, k);
+    reach = (reach + (len - 1) < reach) ? 0xffffffffU : reach + (len - 1);
+    e = k;
+    while(e < idx->npoints && gz_chunkstart(idx, e + 1) < reach)
+    {
+        ++e;
+    }
+
+    for(i = 2;
+        i < len;
+        ++i)
+    {
+        g = (unsigned int)needle[i - 2] << 16 |
+            (unsigned int)needle[i - 1] << 8 | needle[i];
+        for(c = k;
+            c <= e;
+            ++c)
+        {
+            if(gz_bloomhas(idx, c, g))
+            {
+                break;
+            }
+        }
+
+        if(c > e)
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+/* Sink reporting the matches that start from from up to to, until
+   pos (the offset of the next byte it gets) reaches end. The len - 1
+   bytes before a match's last one are still in the window in front of
+   it. */
+typedef struct
+gz_search
+{
+    unsigned char *needle;
+    unsigned int len;
+    unsigned int from;
+    unsigned int to;
+    unsigned int end;
+    unsigned int pos;
+    gz_matchfn match;
+    void *user;
+    int stopped;
+} gz_search;
+
+static int
+gz_searchsink(void *user, void *data, unsigned int size)
+{
+    gz_search *s;
+    unsigned char *p, *q, last;
+    unsigned int i, j, at;
+
+    s = (gz_search *)user;
+    p = (unsigned char *)data;
+    last = s->needle[s->len - 1];
+    for(i = 0;
+        i < size;
+        ++i)
+    {
+        if(p[i] != last || s->pos + i - s->from + 1 < s->len)
+        {
+            continue;
+        }
+
+        at = s->pos + i + 1 - s->len;
+        if(at >= s->to)
+        {
+            break;
+        }
+
+        q = p + i + 1 - s->len;
+        for(j = 0;
+            j + 1 < s->len && q[j] == s->needle[j];
+            ++j)
+        {
+        }
+
+        if(j + 1 == s->len && s->match(s->user, at))
+        {
+            s->stopped = 1;
+            return(1);
+        }
+    }
+
+    s->pos += size;
+    return(s->pos >= s->end);
+}
+
+int
+gzindexsearch(
+    gz_index *idx, void *in, unsigned int insize,
+    void *needle, unsigned int len,
+    void *window, unsigned int windowsize,
+    gz_matchfn match, void *user)
+{
+    gz_out o;
+    gz_search s;
+    unsigned int k, e;
+    int result;
+
+    if(!in || !window || !needle || !match)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(windowsize < 2*GZ_WINDOW)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    if(len > GZ_WINDOW)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    s.needle = (unsigned char *)needle;
+    s.len = len;
+    s.match = match;
+    s.user = user;
+    s.stopped = 0;
+    k = 0;
+    while(len > 0 && k <= idx->npoints)
+    {
+        if(!gz_chunkmay(idx, k, s.needle, len))
+        {
+            ++k;
+            continue;
+        }
+
+        e = k;
+        while(e < idx->npoints && gz_chunkmay(idx, e + 1, s.needle, len))
+        {
+            ++e;
+        }
+
+        s.from = gz_chunkstart(idx, k);
+        s.to = gz_chunkend(idx, e);
+        s.end = (s.to + (len - 1) < s.to) ? 0xffffffffU : s.to + (len - 1);
+        s.pos = s.from;
+        gz_outinit(&o, window, windowsize, gz_searchsink, &s, 0);
+        o.window = 1;
+        result = gz_pointdec(idx, k ? k - 1 : idx->npoints,
+                             (unsigned char *)in, insize, &o);
+        if(result == GZ_ABORTED && !s.stopped)
+        {
+            result = GZ_OK;
+        }
+
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+
+        k = e + 1;
+    }
+
+    return(GZ_OK);
+}
+
+/**
+  Batch decompression. gzbatchplan() reads the decoded size of every job
+  from the ISIZE of its last gzip member or of all its BGZF blocks, and
+  orders the jobs largest first, so the long ones start early and the
+  short ones fill the gaps at the end. Jobs smaller than groupsize are
+  packed together into groups of about groupsize bytes, so that a worker
+  takes many small files at once instead of paying per-file dispatch for
+  each. Group g is order[groups[g]] up to order[groups[g + 1]]; groups
+  needs njobs + 1 entries. Workers then call gzbatchrun() on the groups
+  in ascending order, each group on whichever thread is free:
+
+  n = gzbatchplan(jobs, njobs, order, groups, 1 << 20);
+  for(g = 0; g < n; ++g)   (spread across threads)
+  {
+      gzbatchrun(jobs, order, groups[g], groups[g + 1]);
+  }
+
+  The size of a BGZF file is exact. Plain gzip members carry no length,
+  so a multi-member file counts only its last member, and a file with
+  trailing zero padding counts its compressed size; planning reads no
+  more than that, and the sizes only affect the order of jobs. The
+  decode itself gives the exact size, in outlen.
+
+  Large BGZF files can be split into independent parts with
+  gzbgzfsplit() beforehand, each decoding into its own slice of the
+  output, so they are decoded by several workers at once.
+
+  gzbatchtimed() is gzbatchrun() that also times every job with the
+  caller's clock, filling in its ticks and its rate in decoded bytes
+  per tick (taking at least one tick). gzbatchreport() then sums up a
+  batch, given the ticks it took from start to end across all workers:
+
+  start = now();
+  gzbatchtimed(jobs, order, groups[g], groups[g + 1], clock, user);
+  ...
+  gzbatchreport(jobs, njobs, now() - start, &report);
+  gztune(&tune, report.rate);
+
+  Decoding is reentrant and keeps no state outside the caller's
+  objects, so jobs may run on any threads without setup.
+*/
+
+/* Decoded size of a BGZF file from the ISIZE of each block, 0 if it is
+   not well formed */
+static unsigned int
+gz_bgzfsize(unsigned char *in, unsigned int insize)
+{
+    unsigned int pos, bsize, size;
+
+    pos = 0;
+    size = 0;
+    while(pos < insize)
+    {
+        bsize = gz_bgzfbsize(in + pos, insize - pos);
+        if(bsize == 0 || bsize > insize - pos)
+        {
+            return(0);
+        }
+        size += gz_read32le(in + pos + bsize - 4);
+        pos += bsize;
+    }
+
+    return(size);
+}
+
+/* Scheduling weight of a job: its decoded size when known */
+static unsigned int
+gz_jobcost(gz_job *job)
+{
+    return(job->size ? job->size : job->insize);
+}
+
+/* Sift down for a heap ordered with the smallest cost on top, so the
+   sorted result is largest first */
+static void
+gz_jobsift(gz_job *jobs, unsigned int *order, unsigned int i, unsigned int n)
+{
+    unsigned int child, tmp;
+
+    for(;;)
+    {
+        child = 2*i + 1;
+        if(child >= n)
+        {
+            break;
+        }
+
+        if(child + 1 < n &&
+           gz_jobcost(&jobs[order[child + 1]]) <
+           gz_jobcost(&jobs[order[child]]))
+        {
+            ++child;
+        }
+
+        if(gz_jobcost(&jobs[order[i]]) <= gz_jobcost(&jobs[order[child]]))
+        {
+            break;
+        }
+
+        tmp = order[i];
+        order[i] = order[child];
+        order[child] = tmp;
+        i = child;
+    }
+}
+
+unsigned int
+gzbatchplan(
+    gz_job *jobs, unsigned int njobs,
+    unsigned int *order, unsigned int *groups, unsigned int groupsize)
+{
+    gz_job *job;
+    unsigned int i, n, tmp, ngroups, packed;
+    int format;
+
+    for(i = 0;
+        i < njobs;
+        ++i)
+    {
+        job = &jobs[i];
+        format = gzformat(job->in, job->insize);
+        if(format == GZ_FMT_BGZF)
+        {
+            job->size = gz_bgzfsize((unsigned char *)job->in, job->insize);
+        }
+        else if(format == GZ_FMT_GZIP)
+        {
+            job->size = gzdecsize(job->in, job->insize);
+        }
+        else
+        {
+            job->size = 0;
+        }
+        job->result = GZ_OK;
+        job->outlen = 0;
+        job->ticks = 0;
+        job->rate = 0;
+        order[i] = i;
+    }
+
+    /* Heap sort, largest cost first */
+    for(i = njobs / 2;
+        i > 0;
+        --i)
+    {
+        gz_jobsift(jobs, order, i - 1, njobs);
+    }
+
+    for(n = njobs;
+        n > 1;
+        --n)
+    {
+        tmp = order[0];
+        order[0] = order[n - 1];
+        order[n - 1] = tmp;
+        gz_jobsift(jobs, order, 0, n - 1);
+    }
+
+    /* One group per large job, then small jobs packed together */
+    ngroups = 0;
+    packed = 0;
+    for(i = 0;
+        i < njobs;
+        ++i)
+    {
+        if(i == 0 || gz_jobcost(&jobs[order[i]]) >= groupsize ||
+           packed >= groupsize)
+        {
+            groups[ngroups++] = i;
+            packed = 0;
+        }
+        packed += gz_jobcost(&jobs[order[i]]);
+    }
+    groups[ngroups] = njobs;
+
+    return(ngroups);
+}
+
+int
+gzbatchrun(
+    gz_job *jobs, unsigned int *order,
+    unsigned int first, unsigned int last)
+{
+    return(gzbatchtimed(jobs, order, first, last, 0, 0));
+}
+
+int
+gzbatchtimed(
+    gz_job *jobs, unsigned int *order,
+    unsigned int first, unsigned int last,
+    gz_clockfn clock, void *user)
+{
+    gz_job *job;
+    unsigned int start;
+    int result;
+
+    result = GZ_OK;
+    while(first < last)
+    {
+        job = &jobs[order[first++]];
+        start = clock ? clock(user) : 0;
+        job->result = gzdecany(
+            job->in, job->insize, job->out, job->outsize,
+            &job->outlen, 0, 0);
+        if(clock)
+        {
+            job->ticks = clock(user) - start;
+            job->rate = job->outlen / (job->ticks ? job->ticks : 1);
+        }
+
+        if(job->result != GZ_OK && result == GZ_OK)
+        {
+            result = job->result;
+        }
+    }
+
+    return(result);
+}
+
+/* Adds size to the two word total at lo, hi */
+static void
+gz_add64(unsigned int *lo, unsigned int *hi, unsigned int size)
+{
+    *lo += size;
+    if(*lo < size)
+    {
+        ++*hi;
+    }
+}
+
+/* Total bytes at lo, hi per tick, saturated to 32 bits */
+static unsigned int
+gz_rate64(unsigned int lo, unsigned int hi, unsigned int ticks)
+{
+    double rate;
+
+    rate = ((double)hi * 4294967296.0 + lo) / (ticks ? ticks : 1);
+    return((rate >= 4294967295.0) ? 0xffffffffU : (unsigned int)rate);
+}
+
+void
+gzbatchreport(
+    gz_job *jobs, unsigned int njobs, unsigned int ticks,
+    gz_report *report)
+{
+    gz_job *job;
+    unsigned int i;
+
+    gz_memset(report, 0, sizeof(gz_report));
+    for(i = 0;
+        i < njobs;
+        ++i)
+    {
+        job = &jobs[i];
+        ++report->files;
+        if(job->result != GZ_OK)
+        {
+            ++report->failed;
+        }
+        gz_add64(&report->insize, &report->insizehi, job->insize);
+        gz_add64(&report->outsize, &report->outsizehi, job->outlen);
+        report->ticks += job->ticks;
+    }
+
+    report->rate = gz_rate64(report->outsize, report->outsizehi, ticks);
+    report->workerrate = gz_rate64(
+        report->outsize, report->outsizehi, report->ticks);
+}
+
+unsigned int
+gzbgzfsplit(
+    void *in, unsigned int insize, void *out, unsigned int outsize,
+    gz_job *parts, unsigned int maxparts, unsigned int partsize)
+{
+    unsigned char *p;
+    unsigned int pos, bsize, isize, start, ustart, usize, n;
+
+    p = (unsigned char *)in;
+    pos = 0;
+    start = 0;
+    ustart = 0;
+    usize = 0;
+    n = 0;
+    while(pos < insize)
+    {
+        bsize = gz_bgzfbsize(p + pos, insize - pos);
+        if(bsize == 0 || bsize > insize - pos)
+        {
+            return(0);
+        }
+
+        isize = gz_read32le(p + pos + bsize - 4);
+        pos += bsize;
+        usize += isize;
+
+        if(usize >= partsize || pos == insize)
+        {
+            if(n >= maxparts || ustart + usize > outsize)
+            {
+                return(0);
+            }
+
+            parts[n].in = p + start;
+            parts[n].insize = pos - start;
+            parts[n].out = (unsigned char *)out + ustart;
+            parts[n].outsize = usize;
+            ++n;
+
+            start = pos;
+            ustart += usize;
+            usize = 0;
+        }
+    }
+
+    return(n);
+}
+
+/**
+  Memory accounting. The library never allocates: every byte it works
+  with is either on the stack of a decode or in a buffer or object the
+  caller owns. gzdecmem() estimates the stack a single decode needs on
+  top of its caller's: its large locals, the code trees and code length
+  arrays, plus an allowance for the frames around them (measured at
+  about 1K with gcc on x86-64; other compilers may need more).
+  gzbammem() is what a BAM iterator holds, gzindexmem() what an index
+  of n points holds, and gzbatchmem() what one batch group needs while
+  it runs (its output buffers plus a decode's working memory).
+
+  gzbatchworkers() gives the number of workers that keep a batch within
+  budget bytes. Groups are planned largest first, so it counts the
+  leading groups until their sum passes the budget: a tighter budget
+  gives fewer workers, down to one, and one that cannot hold even the
+  largest group gives 0, as the batch cannot run within it at all.
+*/
+
+static unsigned int
+gz_addsat(unsigned int a, unsigned int b)
+{
+    return((a > 0xffffffffU - b) ? 0xffffffffU : a + b);
+}
+
+unsigned int
+gzdecmem(void)
+{
+    return((unsigned int)(
+        sizeof(gz_trees) +
+        sizeof(unsigned int) * (2*GZ_CLEN_MAX + 2*(GZ_LL_MAX + GZ_DIST_MAX)) +
+        sizeof(gz_out) + sizeof(gz_bstream) + 2048));
+}
+
+unsigned int
+gzindexmem(unsigned int npoints)
+{
+    unsigned int per;
+
+    per = (unsigned int)sizeof(gz_point) + GZ_WINDOW;
+    return((npoints > 0xffffffffU / per) ? 0xffffffffU : npoints * per);
+}
+
+unsigned int
+gzbammem(gz_bam *bam)
+{
+    return(gz_addsat((unsigned int)sizeof(gz_bam), bam->stitchsize));
+}
+
+unsigned int
+gzbatchmem(
+    gz_job *jobs, unsigned int *order, unsigned int *groups, unsigned int g)
+{
+    gz_job *job;
+    unsigned int i, mem;
+
+    mem = gzdecmem();
+    for(i = groups[g];
+        i < groups[g + 1];
+        ++i)
+    {
+        job = &jobs[order[i]];
+        mem = gz_addsat(mem, job->outsize ? job->outsize : job->size);
+    }
+
+    return(mem);
+}
+
+unsigned int
+gzbatchworkers(
+    gz_job *jobs, unsigned int *order,
+    unsigned int *groups, unsigned int ngroups,
+    unsigned int budget, unsigned int maxworkers)
+{
+    unsigned int n, mem;
+
+    mem = 0;
+    for(n = 0;
+        n < maxworkers && n < ngroups;
+        ++n)
+    {
+        mem = gz_addsat(mem, gzbatchmem(jobs, order, groups, n));
+        if(mem > budget)
+        {
+            break;
+        }
+    }
+
+    return(n);
+}
+
+/**
+  Worker count tuning. More workers stop paying off once memory
+  bandwidth runs out, and where that happens depends on the host and
+  the data. gztune() is told the throughput (in any unit, e.g. bytes per
+  millisecond) of a run with tune->workers workers and returns the count
+  to use next. It doubles the count while each step brings at least
+  gain percent more, then bisects above and below the best count found
+  and settles on the fewest workers within gain percent of the best
+  throughput (tune->done). gz_tune is plain data: keep one per format
+  (see gzformat()) and store it per host, so the next run starts from
+  the settled count. Call gztuneinit() again to retune.
+
+  gztuneinit(&tune, gzbatchworkers(jobs, order, groups, n, budget, ncpu));
+  while(more batches)
+  {
+      rate = run_batch(tune.workers);
+      gztune(&tune, rate);
+  }
+*/
+
+void
+gztuneinit(gz_tune *tune, unsigned int maxworkers)
+{
+    tune->maxworkers = maxworkers ? maxworkers : 1;
+    tune->workers = 1;
+    tune->gain = 5;
+    tune->best = 1;
+    tune->bestrate = 0;
+    tune->lo = 0;
+    tune->hi = 0;
+    tune->down = 0;
+    tune->done = (tune->maxworkers == 1);
+}
+
+/* rate plus gain percent of it, without overflow for large rates */
+static unsigned int
+gz_tunegain(gz_tune *tune, unsigned int rate)
+{
+    return(rate / 100 * tune->gain + rate % 100 * tune->gain / 100);
+}
+
+unsigned int
+gztune(gz_tune *tune, unsigned int rate)
+{
+    unsigned int w;
+
+    if(tune->done)
+    {
+        return(tune->workers);
+    }
+
+    w = tune->workers;
+    if(tune->down)
+    {
+        /* Fewer workers are as good if within gain of the best */
+        if(rate >= tune->bestrate - gz_tunegain(tune, tune->bestrate))
+        {
+            tune->best = w;
+        }
+        else
+        {
+            tune->lo = w;
+        }
+    }
+    else if(tune->bestrate == 0 ||
+            rate > tune->bestrate + gz_tunegain(tune, tune->bestrate))
+    {
+        tune->lo = (tune->bestrate == 0) ? 0 : tune->best;
+        tune->best = w;
+        tune->bestrate = rate;
+    }
+    else
+    {
+        tune->hi = w;
+    }
+
+    if(!tune->down && tune->hi == 0 && tune->best < tune->maxworkers)
+    {
+        /* Ramping up */
+        w = (tune->best > tune->maxworkers / 2) ?
+            tune->maxworkers : 2 * tune->best;
+    }
+    else if(!tune->down && tune->hi > tune->best + 1)
+    {
+        w = tune->best + (tune->hi - tune->best) / 2;
+    }
+    else
+    {
+        tune->down = 1;
+        if(tune->best > tune->lo + 1)
+        {
+            w = tune->lo + (tune->best - tune->lo) / 2;
+        }
+        else
+        {
+            tune->done = 1;
+            w = tune->best;
+        }
+    }
+
+    tune->workers = w;
+    return(w);
+}
+
+/**
+  Column projection for CSV/TSV, run as a sink so each chunk is parsed
+  right after it is decoded. Only the selected columns are reported, as
+  views into the output buffer; a field enclosed in quotes is reported
+  without them, but doubled quotes inside are left as they are. The
+  output must be contiguous, as with gzdecsink() and gzdecany().
+
+  unsigned char select[3] = {1, 0, 1};
+  gz_csv csv;
+
+  gzcsvinit(&csv, ',', '"', select, 3, on_field, user);
+  result = gzdecsink(in, insize, out, outsize, gzcsvsink, &csv);
+  gzcsvend(&csv);
+*/
+
+void
+gzcsvinit(
+    gz_csv *csv, int delim, int quote,
+    unsigned char *select, unsigned int nselect,
+    gz_fieldfn field, void *user)
+{
+    csv->delim = delim;
+    csv->quote = quote;
+    csv->select = select;
+    csv->nselect = nselect;
+    csv->field = field;
+    csv->user = user;
+    csv->fstart = 0;
+    csv->last = 0;
+    csv->row = 0;
+    csv->col = 0;
+    csv->inquote = 0;
+}
+
+static int
+gz_csvfield(gz_csv *csv, unsigned char *end)
+{
+    unsigned char *p;
+    unsigned int size;
+
+    if(csv->col >= csv->nselect || !csv->select[csv->col])
+    {
+        return(0);
+    }
+
+    p = csv->fstart;
+    size = (unsigned int)(end - p);
+    if(csv->quote >= 0 && size >= 2 &&
+       p[0] == csv->quote && p[size - 1] == csv->quote)
+    {
+        ++p;
+        size -= 2;
+    }
+
+    return(csv->field(csv->user, csv->row, csv->col, (char *)p, size));
+}
+
+int
+gzcsvsink(void *user, void *data, unsigned int size)
+{
+    gz_csv *csv;
+    unsigned char *p, *end, *e;
+    unsigned int v, hit;
+    int q, wide;
+
+    csv = (gz_csv *)user;
+    p = (unsigned char *)data;
+    end = p + size;
+    csv->last = end;
+    if(!csv->fstart)
+    {
+        csv->fstart = p;
+    }
+
+    /* without quoting, look for newlines twice instead */
+    q = (csv->quote >= 0) ? csv->quote : '\n';
+
+    while(p < end)
+    {
+        if(csv->inquote)
+        {
+            while(end - p >= 4 && !GZ_HASBYTE(gz_read32le(p), q))
+            {
+                p += 4;
+            }
+            while(p < end && *p != q)
+            {
+                ++p;
+            }
+            if(p == end)
+            {
+                break;
+            }
+            csv->inquote = 0;
+            ++p;
+            continue;
+        }
+
+        /* Past the last selected column only row ends matter */
+        wide = (csv->col < csv->nselect);
+        if(end - p >= 4)
+        {
+            v = gz_read32le(p);
+            hit = GZ_HASBYTE(v, '\n') | GZ_HASBYTE(v, q);
+            if(wide)
+            {
+                hit |= GZ_HASBYTE(v, csv->delim);
+            }
+            if(!hit)
+            {
+                p += 4;
+                continue;
+            }
+        }
+
+        if(*p == csv->quote)
+        {
+            csv->inquote = 1;
+        }
+        else if(*p == csv->delim && wide)
+        {
+            if(gz_csvfield(csv, p))
+            {
+                return(1);
+            }
+            ++csv->col;
+            csv->fstart = p + 1;
+        }
+        else if(*p == '\n')
+        {
+            e = p;
+            if(e > csv->fstart && e[-1] == '\r')
+            {
+                --e;
+            }
+            if(gz_csvfield(csv, e))
+            {
+                return(1);
+            }
+            ++csv->row;
+            csv->col = 0;
+            csv->fstart = p + 1;
+        }
+        ++p;
+    }
+
+    return(0);
+}
+
+/* Report the last field when the data does not end with a newline */
+int
+gzcsvend(gz_csv *csv)
+{
+    int result;
+
+    result = 0;
+    if(csv->fstart && csv->fstart < csv->last)
+    {
+        result = gz_csvfield(csv, csv->last);
+        ++csv->row;
+        csv->col = 0;
+        csv->fstart = csv->last;
+    }
+
+    return(result);
+}
+
+/**
+  JSON Lines (NDJSON) as a sink: records are split at newlines as each
+  chunk is decoded, and every record gets a structural index, the
+  offsets of its { } [ ] : , characters and of the quotes opening and
+  closing its strings, ready for a parser to walk without rescanning
+  the text. The index also checks that strings are terminated and
+  brackets balanced. Blank lines are skipped. On a malformed record, or
+  one with more than indexmax structural characters, the sink stops and
+  nd.error says why (GZ_INVFILE, GZ_NOSPACE or GZ_UNSUPPORTED for
+  nesting deeper than GZ_JSON_DEPTH). The output must be contiguous.
+
+  gz_ndjson nd;
+
+  gzndjsoninit(&nd, index, indexmax, on_record, user);
+  result = gzdecsink(in, insize, out, outsize, gzndjsonsink, &nd);
+  if(result == GZ_OK)
+  {
+      result = gzndjsonend(&nd);
+  }
+*/
+
+#define GZ_JSON_DEPTH 64
+
+void
+gzndjsoninit(
+    gz_ndjson *nd, unsigned int *index, unsigned int indexmax,
+    gz_jsonfn record, void *user)
+{
+    nd->record = record;
+    nd->user = user;
+    nd->index = index;
+    nd->indexmax = indexmax;
+    nd->error = GZ_OK;
+    nd->rstart = 0;
+    nd->last = 0;
+    nd->line = 0;
+}
+
+/* Index one record and hand it out */
+static int
+gz_ndjsonrec(gz_ndjson *nd, unsigned char *rec, unsigned char *end)
+{
+    unsigned char stack[GZ_JSON_DEPTH];
+    unsigned char *p;
+    unsigned int n, depth, v;
+    int c;
+
+    if(end > rec && end[-1] == '\r')
+    {
+        --end;
+    }
+
+    n = 0;
+    depth = 0;
+    p = rec;
+    while(p < end)
+    {
+        c = *p;
+        if(c == '"')
+        {
+            if(n >= nd->indexmax)
+            {
+                nd->error = GZ_NOSPACE;
+                return(1);
+            }
+            nd->index[n++] = (unsigned int)(p - rec);
+
+            /* Find the closing quote, stepping over escapes */
+            ++p;
+            for(;;)
+            {
+                while(end - p >= 4)
+                {
+                    v = gz_read32le(p);
+                    if(GZ_HASBYTE(v, '"') || GZ_HASBYTE(v, '\\'))
+                    {
+                        break;
+                    }
+                    p += 4;
+                }
+                while(p < end && *p != '"' && *p != '\\')
+                {
+                    ++p;
+                }
+                if(p >= end)
+                {
+                    nd->error = GZ_INVFILE;
+                    return(1);
+                }
+                if(*p == '"')
+                {
+                    break;
+                }
+                p += 2;
+            }
+            c = '"';
+        }
+        else if(c == '{' || c == '[')
+        {
+            if(depth >= GZ_JSON_DEPTH)
+            {
+                nd->error = GZ_UNSUPPORTED;
+                return(1);
+            }
+            stack[depth++] = (unsigned char)((c == '{') ? '}' : ']');
+        }
+        else if(c == '}' || c == ']')
+        {
+            if(depth == 0 || stack[--depth] != c)
+            {
+                nd->error = GZ_INVFILE;
+                return(1);
+            }
+        }
+        else if(c != ':' && c != ',')
+        {
+            ++p;
+            continue;
+        }
+
+        if(n >= nd->indexmax)
+        {
+            nd->error = GZ_NOSPACE;
+            return(1);
+        }
+        nd->index[n++] = (unsigned int)(p - rec);
+        ++p;
+    }
+
+    if(depth != 0)
+    {
+        nd->error = GZ_INVFILE;
+        return(1);
+    }
+
+    if(end == rec)
+    {
+        return(0);
+    }
+
+    if(nd->record(nd->user, nd->line, (char *)rec,
+                  (unsigned int)(end - rec), nd->index, n))
+    {
+        nd->error = GZ_ABORTED;
+        return(1);
+    }
+
+    return(0);
+}
+
+int
+gzndjsonsink(void *user, void *data, unsigned int size)
+{
+    gz_ndjson *nd;
+    unsigned char *p, *end;
+
+    nd = (gz_ndjson *)user;
+    p = (unsigned char *)data;
+    end = p + size;
+    nd->last = end;
+    if(!nd->rstart)
+    {
+        nd->rstart = p;
+    }
+
+    while(p < end)
+    {
+        while(end - p >= 4 && !GZ_HASBYTE(gz_read32le(p), '\n'))
+        {
+            p += 4;
+        }
+        while(p < end && *p != '\n')
+        {
+            ++p;
+        }
+        if(p == end)
+        {
+            break;
+        }
+
+        if(gz_ndjsonrec(nd, nd->rstart, p))
+        {
+            return(1);
+        }
+        ++nd->line;
+        ++p;
+        nd->rstart = p;
+    }
+
+    return(0);
+}
+
+/* Hand out the last record when the data does not end with a newline */
+int
+gzndjsonend(gz_ndjson *nd)
+{
+    if(nd->rstart && nd->rstart < nd->last)
+    {
+        if(gz_ndjsonrec(nd, nd->rstart, nd->last))
+        {
+            return(nd->error);
+        }
+        ++nd->line;
+        nd->rstart = nd->last;
+    }
+
+    return(GZ_OK);
+}
+
+#undef GZ_JSON_DEPTH
+
+/**
+  BAM records (SAM/BAM format specification, section 4) from a BGZF file
+  held in memory. Blocks are located through the BSIZE subfield of their
+  gzip extra field and decoded one at a time into the iterator. Records
+  inside a block are handed out in place; only records spanning blocks
+  are copied, into the caller's stitch buffer.
+
+  gz_bam bam;
+  gz_bamrec rec;
+
+  result = gzbamopen(&bam, in, insize, stitch, stitchsize);
+  while(result == GZ_OK && (result = gzbamnext(&bam, &rec)) == GZ_OK)
+  {
+      use(rec.data, rec.size);
+  }
+
+  gzbaiseek() positions the iterator for a region query through a .bai
+  file (its linear index) or a .csi file (the loffset of its bins);
+  records before beg or on other references are left to the caller to
+  skip. GZ_END means no record of refid reaches beg. gz_bam is large
+  (it holds a whole BGZF block), so it should not live on the stack.
+*/
+
+/* Decode the BGZF block at coff */
+static int
+gz_bamblock(gz_bam *bam, unsigned int coff)
+{
+    gz_out o;
+    unsigned int bsize, used;
+    int result;
+
+    if(coff >= bam->insize)
+    {
+        return(GZ_END);
+    }
+
+    bsize = gz_bgzfbsize(bam->in + coff, bam->insize - coff);
+    if(bsize == 0 || bsize > bam->insize - coff)
+    {
+        return(GZ_INVFILE);
+    }
+
+    gz_outinit(&o, bam->block, GZ_BGZF_MAX, 0, 0, 0);
+    result = gz_member(bam->in + coff, bsize, &o, &used);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    bam->coff = coff;
+    bam->nextcoff = coff + bsize;
+    bam->blen = (unsigned int)(o.ptr - o.start);
+    bam->upos = 0;
+
+    return(GZ_OK);
+}
+
+/* Copy (or skip, without dst) size bytes, moving across blocks */
+static int
+gz_bamread(gz_bam *bam, unsigned char *dst, unsigned int size)
+{
+    unsigned int n;
+    int result;
+
+    while(size > 0)
+    {
+        while(bam->upos == bam->blen)
+        {
+            result = gz_bamblock(bam, bam->nextcoff);
+            if(result != GZ_OK)
+            {
+                return((result == GZ_END) ? GZ_INVFILE : result);
+            }
+        }
+
+        n = bam->blen - bam->upos;
+        if(n > size)
+        {
+            n = size;
+        }
+
+        size -= n;
+        if(dst)
+        {
+            while(n > 0)
+            {
+                *dst++ = bam->block[bam->upos++];
+                --n;
+            }
+        }
+        else
+        {
+            bam->upos += n;
+        }
+    }
+
+    return(GZ_OK);
+}
+
+int
+gzbamopen(
+    gz_bam *bam, void *in, unsigned int insize,
+    void *stitch, unsigned int stitchsize)
+{
+    unsigned char buf[4];
+    unsigned int i;
+    int result;
+
+    bam->in = (unsigned char *)in;
+    bam->insize = insize;
+    bam->stitch = (unsigned char *)stitch;
+    bam->stitchsize = stitchsize;
+    bam->nref = 0;
+
+    result = gz_bamblock(bam, 0);
+    if(result != GZ_OK)
+    {
+        return((result == GZ_END) ? GZ_INVFILE : result);
+    }
+
+    result = gz_bamread(bam, buf, 4);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    if(buf[0] != 'B' || buf[1] != 'A' || buf[2] != 'M' || buf[3] != 1)
+    {
+        return(GZ_INVMAGIC);
+    }
+
+    /* Skip the SAM header text */
+    result = gz_bamread(bam, buf, 4);
+    if(result == GZ_OK)
+    {
+        result = gz_bamread(bam, 0, gz_read32le(buf));
+    }
+
+    if(result == GZ_OK)
+    {
+        result = gz_bamread(bam, buf, 4);
+    }
+
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    /* Skip the reference names and lengths */
+    bam->nref = gz_read32le(buf);
+    for(i = 0;
+        i < bam->nref;
+        ++i)
+    {
+        result = gz_bamread(bam, buf, 4);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+
+        /* l_name bytes of name, then l_ref */
+        result = gz_bamread(bam, 0, gz_read32le(buf));
+        if(result == GZ_OK)
+        {
+            result = gz_bamread(bam, 0, 4);
+        }
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+    }
+
+    return(GZ_OK);
+}
+
+int
+gzbamnext(gz_bam *bam, gz_bamrec *rec)
+{
+    unsigned char buf[4];
+    unsigned int size;
+    int result;
+
+    /* Move past exhausted (and empty) blocks */
+    while(bam->upos == bam->blen)
+    {
+        result = gz_bamblock(bam, bam->nextcoff);
+        if(result != GZ_OK)
+        {
+            return(result);
+        }
+    }
+
+    rec->coff = bam->coff;
+    rec->uoff = bam->upos;
+
+    if(bam->blen - bam->upos >= 4)
+    {
+        size = gz_read32le(bam->block + bam->upos);
+        if(bam->blen - bam->upos - 4 >= size)
+        {
+            rec->data = bam->block + bam->upos + 4;
+            rec->size = size;
+            bam->upos += 4 + size;
+            return(GZ_OK);
+        }
+    }
+
+    /* The record spans blocks */
+    result = gz_bamread(bam, buf, 4);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    size = gz_read32le(buf);
+    if(size > bam->stitchsize)
+    {
+        return(GZ_NOSPACE);
+    }
+
+    result = gz_bamread(bam, bam->stitch, size);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    rec->data = bam->stitch;
+    rec->size = size;
+
+    return(GZ_OK);
+}
+
+int
+gzbamseek(gz_bam *bam, unsigned int coff, unsigned int uoff)
+{
+    int result;
+
+    result = gz_bamblock(bam, coff);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    if(uoff > bam->blen)
+    {
+        return(GZ_INVFILE);
+    }
+
+    bam->upos = uoff;
+    return(GZ_OK);
+}
+
+/* The first record overlapping beg on refid is in the smallest bin of
+   a .csi index that holds beg, and no earlier than the loffset of that
+   bin or any bin around it. Without one, nothing overlaps beg and the
+   first bin starting after it is taken. p is past the magic. */
+static int
+gz_csiseek(
+    gz_bam *bam, unsigned char *p, unsigned char *end,
+    unsigned int refid, unsigned int beg)
+{
+    unsigned int shift, depth, naux, nref, nbin, nchunk, i, j;
+    unsigned int bin, level, first, s, k, at, lo, hi;
+    unsigned int bestlevel, bestlo, besthi, nextlo, nexthi;
+    int found, next;
+
+    if(end - p < 16)
+    {
+        return(GZ_INVFILE);
+    }
+
+    shift = gz_read32le(p);
+    depth = gz_read32le(p + 4);
+    naux = gz_read32le(p + 8);
+    p += 12;
+
+    /* Bin numbers of deeper indexes do not fit 32 bits */
+    if(shift > 31 || depth > 10)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    if(naux > (unsigned int)(end - p) || (unsigned int)(end - p) - naux < 4)
+    {
+        return(GZ_INVFILE);
+    }
+    nref = gz_read32le(p + naux);
+    p += naux + 4;
+
+    if(refid >= nref)
+    {
+        return(GZ_INVFILE);
+    }
+
+    found = 0;
+    next = 0;
+    bestlevel = 0;
+    bestlo = besthi = nextlo = nexthi = 0;
+    for(i = 0;
+        i <= refid;
+        ++i)
+    {
+        /* bins: bin, loffset, n_chunk, then n_chunk pairs of offsets */
+        if(end - p < 4)
+        {
+            return(GZ_INVFILE);
+        }
+        nbin = gz_read32le(p);
+        p += 4;
+
+        for(j = 0;
+            j < nbin;
+            ++j)
+        {
+            if(end - p < 16)
+            {
+                return(GZ_INVFILE);
+            }
+            nchunk = gz_read32le(p + 12);
+            if(nchunk > (unsigned int)(end - p - 16) / 16)
+            {
+                return(GZ_INVFILE);
+            }
+
+            bin = gz_read32le(p);
+            lo = gz_read32le(p + 4);
+            hi = gz_read32le(p + 8);
+            p += 16 + 16*nchunk;
+            if(i < refid || (lo == 0 && hi == 0))
+            {
+                continue;
+            }
+
+            /* Level of the bin; past the last one are pseudo-bins */
+            first = 0;
+            for(level = 0;
+                level <= depth && bin >= first + (1U << 3*level);
+                ++level)
+            {
+                first += 1U << 3*level;
+            }
+            if(level > depth)
+            {
+                continue;
+            }
+
+            s = shift + 3*(depth - level);
+            k = bin - first;
+            at = (s > 31) ? 0 : beg >> s;
+            if(k == at)
+            {
+                if(!found || level > bestlevel)
+                {
+                    found = 1;
+                    bestlevel = level;
+                    bestlo = lo;
+                    besthi = hi;
+                }
+            }
+            else if(k > at &&
+                    (!next || hi < nexthi || (hi == nexthi && lo < nextlo)))
+            {
+                next = 1;
+                nextlo = lo;
+                nexthi = hi;
+            }
+        }
+    }
+
+    if(!found)
+    {
+        if(!next)
+        {
+            return(GZ_END);
+        }
+        bestlo = nextlo;
+        besthi = nexthi;
+    }
+
+    if(besthi >> 16)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    return(gzbamseek(bam, (bestlo >> 16) | (besthi << 16), bestlo & 0xffff));
+}
+
+int
+gzbaiseek(
+    gz_bam *bam, void *bai, unsigned int baisize,
+    unsigned int refid, unsigned int beg)
+{
+    unsigned char *p, *end;
+    unsigned int nref, nbin, nchunk, nintv, i, j, lo, hi;
+
+    p = (unsigned char *)bai;
+    end = p + baisize;
+
+    if(baisize >= 4 &&
+       p[0] == 'C' && p[1] == 'S' && p[2] == 'I' && p[3] == 1)
+    {
+        return(gz_csiseek(bam, p + 4, end, refid, beg));
+    }
+
+    if(baisize < 8 || p[0] != 'B' || p[1] != 'A' || p[2] != 'I' || p[3] != 1)
+    {
+        return(GZ_INVMAGIC);
+    }
+
+    nref = gz_read32le(p + 4);
+    if(refid >= nref)
+    {
+        return(GZ_INVFILE);
+    }
+    p += 8;
+
+    for(i = 0;
+        i <= refid;
+        ++i)
+    {
+        /* bins: bin, n_chunk, then n_chunk pairs of virtual offsets */
+        if(end - p < 4)
+        {
+            return(GZ_INVFILE);
+        }
+        nbin = gz_read32le(p);
+        p += 4;
+
+        for(j = 0;
+            j < nbin;
+            ++j)
+        {
+            if(end - p < 8)
+            {
+                return(GZ_INVFILE);
+            }
+            nchunk = gz_read32le(p + 4);
+            if(nchunk > (unsigned int)(end - p - 8) / 16)
+            {
+                return(GZ_INVFILE);
+            }
+            p += 8 + 16*nchunk;
+        }
+
+        /* linear index: one virtual offset per 16 kbp window */
+        if(end - p < 4)
+        {
+            return(GZ_INVFILE);
+        }
+        nintv = gz_read32le(p);
+        p += 4;
+        if(nintv > (unsigned int)(end - p) / 8)
+        {
+            return(GZ_INVFILE);
+        }
+
+        if(i < refid)
+        {
+            p += 8*nintv;
+        }
+    }
+
+    i = beg >> 14;
+    if(i >= nintv && nintv > 0)
+    {
+        i = nintv - 1;
+    }
+
+    /* 0 marks a window without records in older files; the records
+       reaching beg start no earlier than the next window that has any */
+    lo = hi = 0;
+    for(;
+        i < nintv;
+        ++i)
+    {
+        lo = gz_read32le(p + 8*i);
+        hi = gz_read32le(p + 8*i + 4);
+        if(lo || hi)
+        {
+            break;
+        }
+    }
+
+    if(i >= nintv)
+    {
+        return(GZ_END);
+    }
+
+    if(hi >> 16)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    return(gzbamseek(bam, (lo >> 16) | (hi << 16), lo & 0xffff));
+}
+
+/**
+  PNG image data (non-interlaced). The zlib stream is read straight from
+  the IDAT chunks, and every scanline is unfiltered into img as its bytes
+  are decoded, while they are still in cache, so the filtered image is
+  never held as a whole. scratch is only the deflate window: at least
+  2 * GZ_WINDOW bytes, or the filtered size of a smaller image.
+  gzpnginfo() suggests 4 * GZ_WINDOW, which moves the window's history
+  less often. Samples are left as stored: palette indices are not
+  expanded and 16-bit samples stay big-endian.
+
+  gz_png png;
+
+  if(gzpnginfo(in, insize, &png) == GZ_OK)
+  {
+      scratch = malloc(png.scratchsize);
+      img = malloc(png.imgsize);
+      result = gzpng(in, insize, scratch, png.scratchsize, img, png.imgsize);
+  }
+*/
+
+static int
+gz_pngtype(unsigned char *chunk, const char *type)
+{
+    return(chunk[4] == type[0] && chunk[5] == type[1] &&
+           chunk[6] == type[2] && chunk[7] == type[3]);
+}
+
+int
+gzpnginfo(void *in, unsigned int insize, gz_png *png)
+{
+    unsigned char sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    unsigned char *p;
+    unsigned int i, bits;
+
+    p = (unsigned char *)in;
+    if(!p || insize < 8 + 25)
+    {
+        return(GZ_INVFILE);
+    }
+
+    for(i = 0;
+        i < 8;
+        ++i)
+    {
+        if(p[i] != sig[i])
+        {
+            return(GZ_INVMAGIC);
+        }
+    }
+
+    p += 8;
+    if(gz_read32be(p) != 13 || !gz_pngtype(p, "IHDR"))
+    {
+        return(GZ_INVFILE);
+    }
+
+    p += 8;
+    png->width = gz_read32be(p);
+    png->height = gz_read32be(p + 4);
+    png->depth = p[8];
+    png->color = p[9];
+
+    if(p[10] != 0 || p[11] != 0)
+    {
+        return(GZ_INVCMETHOD);
+    }
+
+    if(p[12] != 0)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    switch(png->color)
+    {
+        case 0: png->channels = 1; break;
+        case 2: png->channels = 3; break;
+        case 3: png->channels = 1; break;
+        case 4: png->channels = 2; break;
+        case 6: png->channels = 4; break;
+        default: return(GZ_INVFILE);
+    }
+
+    if(png->depth != 1 && png->depth != 2 && png->depth != 4 &&
+       png->depth != 8 && png->depth != 16)
+    {
+        return(GZ_INVFILE);
+    }
+
+    if(png->width == 0 || png->height == 0)
+    {
+        return(GZ_INVFILE);
+    }
+
+    bits = png->channels * png->depth;
+    if(png->width > (0xffffffffU - 7) / bits)
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    png->stride = (png->width * bits + 7) / 8;
+    png->bpp = (bits < 8) ? 1 : bits / 8;
+
+    if(png->height > 0xffffffffU / (png->stride + 1))
+    {
+        return(GZ_UNSUPPORTED);
+    }
+
+    png->scratchsize = png->height * (png->stride + 1);
+    if(png->scratchsize > 4*GZ_WINDOW)
+    {
+        png->scratchsize = 4*GZ_WINDOW;
+    }
+    png->imgsize = png->height * png->stride;
+
+    return(GZ_OK);
+}
+
+/* Steps the bit reader from one IDAT chunk to the next; user points to
+   the next chunk header and the end of the file */
+static int
+gz_pngrefill(gz_bstream *stream)
+{
+    unsigned char **cur;
+    unsigned char *p, *end;
+    unsigned int len;
+
+    cur = (unsigned char **)stream->user;
+    p = cur[0];
+    end = cur[1];
+
+    while(end - p >= 12)
+    {
+        len = gz_read32be(p);
+        if(!gz_pngtype(p, "IDAT") || len > (unsigned int)(end - p) - 12)
+        {
+            return(0);
+        }
+
+        stream->src = p + 8;
+        stream->ptr = stream->src;
+        stream->srcend = stream->src + len;
+        p = stream->srcend + 4;
+        cur[0] = p;
+
+        if(len > 0)
+        {
+            return(1);
+        }
+    }
+
+    return(0);
+}
+
+static int
+gz_paeth(int a, int b, int c)
+{
+    int p, pa, pb, pc;
+
+    p = a + b - c;
+    pa = (p > a) ? p - a : a - p;
+    pb = (p > b) ? p - b : b - p;
+    pc = (p > c) ? p - c : c - p;
+
+    if(pa <= pb && pa <= pc)
+    {
+        return(a);
+    }
+
+    return((pb <= pc) ? b : c);
+}
 
-            for(i = 256;
-                i <= 279;
-                ++i)
-            {
-                arrll[i] = 7;
-            }
+typedef struct
+gz_pngrows
+{
+    gz_png *png;
+    unsigned char *img;
+    unsigned int row;
+    /* next byte of the current scanline, 0 for its filter type */
+    unsigned int col;
+    unsigned int filter;
+} gz_pngrows;
+
+/* Unfilter bytes i up to end of the current scanline from src; they
+   only depend on img, so a scanline may arrive in any number of pieces */
+static void
+gz_pngunfilter(
+    gz_pngrows *rows, unsigned char *src, unsigned int i, unsigned int end)
+{
+    unsigned char *dst, *prev;
+    unsigned int stride, bpp;
 
-            for(i = 280;
-                i <= 287;
-                ++i)
-            {
-                arrll[i] = 8;
-            }
+    stride = rows->png->stride;
+    bpp = rows->png->bpp;
+    dst = rows->img + rows->row * stride;
+    prev = (rows->row > 0) ? dst - stride : 0;
 
-            for(i = 0;
-                i < DISTLEN;
-                ++i)
+    switch(rows->filter)
+    {
+        case 0:
+        {
+            for(; i < end; ++i)
             {
-                arrdist[i] = 5;
+                dst[i] = *src++;
             }
+        } break;
 
-            if(!gz_buildht(arrll, LLLEN, htll, GZ_HTLL_MAX))
+        case 1:
+        {
+            for(; i < end; ++i)
             {
-                return(GZ_INVFILE);
+                dst[i] = (unsigned char)(*src++ +
+                    ((i >= bpp) ? dst[i - bpp] : 0));
             }
+        } break;
 
-            if(!gz_buildht(arrdist, DISTLEN, htdist, GZ_HTDIST_MAX))
+        case 2:
+        {
+            for(; i < end; ++i)
             {
-                return(GZ_INVFILE);
+                dst[i] = (unsigned char)(*src++ + (prev ? prev[i] : 0));
             }
+        } break;
 
-            todec = 1;
-        }
-        else if(btype == 2)
+        case 3:
         {
-            /* Dynamic Huffman tables */
-            hlit = gz_readbits(&ins, 5);
-            hdist = gz_readbits(&ins, 5);
-            hclen = gz_readbits(&ins, 4);
-
-            if(257 + hlit > LLLEN)
+            for(; i < end; ++i)
             {
-                return(GZ_INVFILE);
+                dst[i] = (unsigned char)(*src++ +
+                    (((i >= bpp) ? dst[i - bpp] : 0) +
+                     (prev ? prev[i] : 0)) / 2);
             }
+        } break;
 
-            /* Construct CL Lengths table */
-            for(i = 0;
-                i < hclen + 4;
-                ++i)
+        default:
+        {
+            for(; i < end; ++i)
             {
-                arrclen[clenord[i]] = gz_readbits(&ins, 3);
+                dst[i] = (unsigned char)(*src++ + gz_paeth(
+                    (i >= bpp) ? dst[i - bpp] : 0,
+                    prev ? prev[i] : 0,
+                    (prev && i >= bpp) ? prev[i - bpp] : 0));
             }
+        } break;
+    }
+}
 
-            if(!gz_buildht(arrclen, MAXCLEN, htclen, GZ_HTCLEN_MAX))
-            {
-                return(GZ_INVFILE);
-            }
+/* Sink unfiltering the decoded bytes into img as they come */
+static int
+gz_pngsink(void *user, void *data, unsigned int size)
+{
+    gz_pngrows *rows;
+    unsigned char *src;
+    unsigned int stride, n;
 
-            if(!gz_gethufft(
-                &ins, arrll, 257 + hlit,
-                LLLEN, htclen,
-                htll, GZ_HTLL_MAX))
-            {
-                return(GZ_INVFILE);
-            }
+    rows = (gz_pngrows *)user;
+    stride = rows->png->stride;
+    src = (unsigned char *)data;
+
+    while(size > 0)
+    {
+        if(rows->row >= rows->png->height)
+        {
+            return(1);
+        }
 
-            if(!gz_gethufft(
-                &ins, arrdist, 1 + hdist,
-                DISTLEN, htclen,
-                htdist, GZ_HTDIST_MAX))
+        if(rows->col == 0)
+        {
+            rows->filter = *src++;
+            --size;
+            if(rows->filter > 4)
             {
-                return(GZ_INVFILE);
+                return(1);
             }
-
-            todec = 1;
+            rows->col = 1;
+            continue;
         }
-        else
+
+        n = stride + 1 - rows->col;
+        if(n > size)
         {
-            return(GZ_INVFILE);
+            n = size;
         }
 
-        if(todec)
+        gz_pngunfilter(rows, src, rows->col - 1, rows->col - 1 + n);
+        src += n;
+        size -= n;
+        rows->col += n;
+        if(rows->col == stride + 1)
         {
-            sym = gz_huffdec(&ins, htll);
-            while(sym != 256)
-            {
-                if(sym < 0 || sym > LLLEN)
-                {
-                    return(GZ_INVFILE);
-                }
+            rows->col = 0;
+            ++rows->row;
+        }
+    }
 
-                if(sym >= 0 && sym <= 255)
-                {
-                    EMIT(sym);
-                }
-                else if(sym == 256)
-                {
-                    break;
-                }
-                else if(sym < LLLEN)
-                {
-                    len = gz_getlen(sym, &ins);
-                    dist = gz_huffdec(&ins, htdist);
-                    dist = gz_getdist(dist, &ins);
+    return(0);
+}
 
-                    if(dist < 0 || len <= 0)
-                    {
-                        return(GZ_INVFILE);
-                    }
+int
+gzpng(
+    void *in, unsigned int insize,
+    void *scratch, unsigned int scratchsize,
+    void *img, unsigned int imgsize)
+{
+    gz_png png;
+    gz_pngrows rows;
+    gz_bstream ins;
+    gz_out o;
+    unsigned char *p, *end, *cur[2];
+    unsigned int cmf, flg, adler, filtered, i;
+    int result;
+
+    result = gzpnginfo(in, insize, &png);
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
 
-                    backp = outp - dist;
-                    if(outp < (unsigned char *)out)
-                    {
-                        return(GZ_INVFILE);
-                    }
+    /* A scratch buffer smaller than the filtered image is a window */
+    filtered = png.height * (png.stride + 1);
+    if(scratchsize > filtered)
+    {
+        scratchsize = filtered;
+    }
 
-                    while(len > 0)
-                    {
-                        EMIT(*backp);
-                        ++backp;
-                        len -= 1;
-                    }
-                }
-                else
-                {
-                    return(GZ_INVFILE);
-                }
+    if(!scratch || !img || imgsize < png.imgsize ||
+       (scratchsize < filtered && scratchsize < 2*GZ_WINDOW))
+    {
+        return(GZ_NOSPACE);
+    }
 
-                sym = gz_huffdec(&ins, htll);
-            }
+    /* Find the first IDAT chunk */
+    p = (unsigned char *)in + 8;
+    end = (unsigned char *)in + insize;
+    while(end - p >= 12 && !gz_pngtype(p, "IDAT"))
+    {
+        if(gz_read32be(p) > (unsigned int)(end - p) - 12)
+        {
+            return(GZ_INVFILE);
         }
+        p += 12 + gz_read32be(p);
+    }
+
+    if(end - p < 12)
+    {
+        return(GZ_INVFILE);
+    }
+
+    cur[0] = p;
+    cur[1] = end;
+    gz_bsinit(&ins, p, 0);
+    ins.refill = gz_pngrefill;
+    ins.user = cur;
+    ins.end = 0;
+    gz_nextbyte(&ins);
+
+    cmf = gz_readbits(&ins, 8);
+    flg = gz_readbits(&ins, 8);
+    if((cmf & 0x0f) != 8 || (cmf >> 4) > 7 ||
+       ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20))
+    {
+        return(GZ_INVFILE);
+    }
+
+    rows.png = &png;
+    rows.img = (unsigned char *)img;
+    rows.row = 0;
+    rows.col = 0;
+    rows.filter = 0;
+
+    gz_outinit(&o, scratch, scratchsize, gz_pngsink, &rows, 0);
+    o.window = (scratchsize < filtered);
+    o.check = GZ_CHECK_ADLER;
+    o.adler = 1;
+
+    result = gz_inflate(&ins, &o, 0);
+    if(result == GZ_ABORTED)
+    {
+        return(GZ_INVFILE);
+    }
+    if(result != GZ_OK)
+    {
+        return(result);
+    }
+
+    gz_alignbyte(&ins);
+    adler = 0;
+    for(i = 0;
+        i < 4;
+        ++i)
+    {
+        adler = (adler << 8) | gz_readbits(&ins, 8);
     }
 
+    if(ins.overrun || adler != o.adler)
+    {
+        return(GZ_INVCRC);
+    }
+
+    if(rows.row != png.height)
+    {
+        return(GZ_INVFILE);
+    }
 
     return(GZ_OK);
+}
 
-#undef EMIT
-#undef DISTCLEN
-#undef LLCLEN
-#undef MAXCLEN
-#undef FTEXT
-#undef FHCRC
-#undef FEXTRA
-#undef FNAME
-#undef FCOMMENT
+/**
+  SHA-256 (FIPS 180-4) and XXH32 sinks, so decoded output can be
+  content-addressed in the same pass that produces it:
+
+  gz_sha256 sha;
+  unsigned char digest[32];
+
+  gzsha256init(&sha);
+  result = gzdecsink(in, insize, out, outsize, gzsha256sink, &sha);
+  gzsha256final(&sha, digest);
+*/
+
+#define GZ_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define GZ_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static unsigned int gz_sha256k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void
+gz_sha256block(gz_sha256 *sha, unsigned char *p)
+{
+    unsigned int w[64];
+    unsigned int a, b, c, d, e, f, g, h;
+    unsigned int t1, t2;
+    int i;
+
+    for(i = 0;
+        i < 16;
+        ++i)
+    {
+        w[i] = ((unsigned int)p[4*i] << 24) |
+               ((unsigned int)p[4*i + 1] << 16) |
+               ((unsigned int)p[4*i + 2] << 8) |
+               ((unsigned int)p[4*i + 3]);
+    }
+
+    for(i = 16;
+        i < 64;
+        ++i)
+    {
+        t1 = GZ_ROTR(w[i-2], 17) ^ GZ_ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        t2 = GZ_ROTR(w[i-15], 7) ^ GZ_ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        w[i] = t1 + w[i-7] + t2 + w[i-16];
+    }
+
+    a = sha->h[0]; b = sha->h[1]; c = sha->h[2]; d = sha->h[3];
+    e = sha->h[4]; f = sha->h[5]; g = sha->h[6]; h = sha->h[7];
+
+    for(i = 0;
+        i < 64;
+        ++i)
+    {
+        t1 = h + (GZ_ROTR(e, 6) ^ GZ_ROTR(e, 11) ^ GZ_ROTR(e, 25)) +
+             ((e & f) ^ (~e & g)) + gz_sha256k[i] + w[i];
+        t2 = (GZ_ROTR(a, 2) ^ GZ_ROTR(a, 13) ^ GZ_ROTR(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    sha->h[0] += a; sha->h[1] += b; sha->h[2] += c; sha->h[3] += d;
+    sha->h[4] += e; sha->h[5] += f; sha->h[6] += g; sha->h[7] += h;
+}
+
+void
+gzsha256init(gz_sha256 *sha)
+{
+    sha->h[0] = 0x6a09e667;
+    sha->h[1] = 0xbb67ae85;
+    sha->h[2] = 0x3c6ef372;
+    sha->h[3] = 0xa54ff53a;
+    sha->h[4] = 0x510e527f;
+    sha->h[5] = 0x9b05688c;
+    sha->h[6] = 0x1f83d9ab;
+    sha->h[7] = 0x5be0cd19;
+    sha->lenlo = 0;
+    sha->lenhi = 0;
+    sha->buflen = 0;
+}
+
+void
+gzsha256update(gz_sha256 *sha, void *data, unsigned int size)
+{
+    unsigned char *p;
+
+    p = (unsigned char *)data;
+
+    sha->lenlo += size;
+    if(sha->lenlo < size)
+    {
+        ++sha->lenhi;
+    }
+
+    while(size > 0 && sha->buflen > 0)
+    {
+        sha->buf[sha->buflen++] = *p++;
+        --size;
+        if(sha->buflen == 64)
+        {
+            gz_sha256block(sha, sha->buf);
+            sha->buflen = 0;
+        }
+    }
+
+    while(size >= 64)
+    {
+        gz_sha256block(sha, p);
+        p += 64;
+        size -= 64;
+    }
+
+    while(size > 0)
+    {
+        sha->buf[sha->buflen++] = *p++;
+        --size;
+    }
+}
+
+void
+gzsha256final(gz_sha256 *sha, unsigned char digest[32])
+{
+    unsigned int bitslo, bitshi;
+    int i;
+
+    bitslo = sha->lenlo << 3;
+    bitshi = (sha->lenhi << 3) | (sha->lenlo >> 29);
+
+    sha->buf[sha->buflen++] = 0x80;
+    if(sha->buflen > 56)
+    {
+        gz_memset(sha->buf + sha->buflen, 0, 64 - sha->buflen);
+        gz_sha256block(sha, sha->buf);
+        sha->buflen = 0;
+    }
+    gz_memset(sha->buf + sha->buflen, 0, 56 - sha->buflen);
+
+    for(i = 0;
+        i < 4;
+        ++i)
+    {
+        sha->buf[56 + i] = (unsigned char)(bitshi >> (24 - 8*i));
+        sha->buf[60 + i] = (unsigned char)(bitslo >> (24 - 8*i));
+    }
+    gz_sha256block(sha, sha->buf);
+
+    for(i = 0;
+        i < 32;
+        ++i)
+    {
+        digest[i] = (unsigned char)(sha->h[i / 4] >> (24 - 8*(i % 4)));
+    }
+}
+
+int
+gzsha256sink(void *user, void *data, unsigned int size)
+{
+    gzsha256update((gz_sha256 *)user, data, size);
+    return(0);
+}
+
+#define GZ_XXH_P1 0x9e3779b1U
+#define GZ_XXH_P2 0x85ebca77U
+#define GZ_XXH_P3 0xc2b2ae3dU
+#define GZ_XXH_P4 0x27d4eb2fU
+#define GZ_XXH_P5 0x165667b1U
+
+static unsigned int
+gz_xxh32round(unsigned int acc, unsigned int val)
+{
+    acc += val * GZ_XXH_P2;
+    acc = GZ_ROTL(acc, 13);
+    return(acc * GZ_XXH_P1);
+}
+
+static void
+gz_xxh32stripe(gz_xxh32 *xxh, unsigned char *p)
+{
+    xxh->v[0] = gz_xxh32round(xxh->v[0], gz_read32le(p));
+    xxh->v[1] = gz_xxh32round(xxh->v[1], gz_read32le(p + 4));
+    xxh->v[2] = gz_xxh32round(xxh->v[2], gz_read32le(p + 8));
+    xxh->v[3] = gz_xxh32round(xxh->v[3], gz_read32le(p + 12));
+}
+
+void
+gzxxh32init(gz_xxh32 *xxh, unsigned int seed)
+{
+    xxh->seed = seed;
+    xxh->v[0] = seed + GZ_XXH_P1 + GZ_XXH_P2;
+    xxh->v[1] = seed + GZ_XXH_P2;
+    xxh->v[2] = seed;
+    xxh->v[3] = seed - GZ_XXH_P1;
+    xxh->len = 0;
+    xxh->large = 0;
+    xxh->buflen = 0;
+}
+
+void
+gzxxh32update(gz_xxh32 *xxh, void *data, unsigned int size)
+{
+    unsigned char *p;
+
+    p = (unsigned char *)data;
+
+    xxh->len += size;
+    if(xxh->len >= 16 || size >= 16)
+    {
+        xxh->large = 1;
+    }
+
+    while(size > 0 && xxh->buflen > 0)
+    {
+        xxh->buf[xxh->buflen++] = *p++;
+        --size;
+        if(xxh->buflen == 16)
+        {
+            gz_xxh32stripe(xxh, xxh->buf);
+            xxh->buflen = 0;
+        }
+    }
+
+    while(size >= 16)
+    {
+        gz_xxh32stripe(xxh, p);
+        p += 16;
+        size -= 16;
+    }
+
+    while(size > 0)
+    {
+        xxh->buf[xxh->buflen++] = *p++;
+        --size;
+    }
 }
 
 unsigned int
-gzdecsize(void *in, unsigned int insize)
+gzxxh32final(gz_xxh32 *xxh)
 {
-    unsigned int decsize;
-    unsigned char *inp;
+    unsigned int h;
+    unsigned int i;
 
-    if(!in || insize < 18)
+    if(xxh->large)
     {
-        return(0);
+        h = GZ_ROTL(xxh->v[0], 1) + GZ_ROTL(xxh->v[1], 7) +
+            GZ_ROTL(xxh->v[2], 12) + GZ_ROTL(xxh->v[3], 18);
+    }
+    else
+    {
+        h = xxh->seed + GZ_XXH_P5;
     }
 
-    decsize = 0;
-    inp = (unsigned char *)in + insize - 4;
-    decsize |= (unsigned int)*inp++;
-    decsize |= ((unsigned int)*inp++) << 8;
-    decsize |= ((unsigned int)*inp++) << 16;
-    decsize |= ((unsigned int)*inp++) << 24;
+    h += xxh->len;
 
-    return(decsize);
+    i = 0;
+    while(i + 4 <= xxh->buflen)
+    {
+        h += gz_read32le(xxh->buf + i) * GZ_XXH_P3;
+        h = GZ_ROTL(h, 17) * GZ_XXH_P4;
+        i += 4;
+    }
+
+    while(i < xxh->buflen)
+    {
+        h += xxh->buf[i] * GZ_XXH_P5;
+        h = GZ_ROTL(h, 11) * GZ_XXH_P1;
+        ++i;
+    }
+
+    h ^= h >> 15;
+    h *= GZ_XXH_P2;
+    h ^= h >> 13;
+    h *= GZ_XXH_P3;
+    h ^= h >> 16;
+
+    return(h);
+}
+
+int
+gzxxh32sink(void *user, void *data, unsigned int size)
+{
+    gzxxh32update((gz_xxh32 *)user, data, size);
+    return(0);
 }
 
+#undef GZ_XXH_P1
+#undef GZ_XXH_P2
+#undef GZ_XXH_P3
+#undef GZ_XXH_P4
+#undef GZ_XXH_P5
+#undef GZ_ROTR
+#undef GZ_ROTL
+
 #undef GZ_HTLL_MAX
 #undef GZ_HTDIST_MAX
 #undef GZ_HTCLEN_MAX
@@ -910,8 +9004,14 @@ gzdecsize(void *in, unsigned int insize)
 #undef GZ_CLEN_MAX
 #undef GZ_RANGE_MAX
 #undef GZ_BL_COUNT_MAX
-#undef GZ_NXTCODE_MA
+#undef GZ_NXTCODE_MAX
 #undef GZ_TREE_MAX
+#undef GZ_TOKFLUSH
+#undef GZ_STREAM_HEAD
+#undef GZ_STREAM_BLOCKS
+#undef GZ_STREAM_TRAILER
+#undef GZ_STREAM_DONE
+#undef GZ_LUTBITS
 
 #endif
 #endif